@@ -0,0 +1,206 @@
+#!/bin/bash
+
+_usage() {
+  cat << EOF
+
+Usage: $0 [scenario ...]
+
+Benchmarks the stack non-interactively: for each language and scenario,
+starts translation_server and that language's greeter_server_demo afresh,
+sets the scenario's BehaviourDefinition (bench/<scenario>.textproto) with
+SetBehaviour, and drives the greeter with greeter_client's open-loop load.
+Records the throughput, latency percentiles, and the greeter's CPU use and
+peak RSS in one results file, which can be diffed between builds.
+
+Runs every scenario in bench/ if none are named. Set in the environment:
+  LANGUAGES       The greeters to compare, of cpp, golang, java and python
+                  (default ${LANGUAGES}).
+  QPS             Calls per second to send (default ${QPS}).
+  DURATION_S      How long to send calls for, per scenario (${DURATION_S}).
+  SEED            Seed for the arrivals and injected behaviour (${SEED}).
+  TRANSLATOR_CPUS, GREETER_CPUS, CLIENT_CPUS
+                  CPU lists to pin each process to with taskset
+                  (${TRANSLATOR_CPUS}, ${GREETER_CPUS}, ${CLIENT_CPUS}).
+  RESULTS         Where to write the results (${RESULTS}).
+  CATALOG         A catalog file for the translator to serve besides its
+                  built-in translations, from build/translation_catalog_gen.
+
+For example, to compare all the greeters:
+  LANGUAGES="cpp golang java python" $0
+
+EOF
+}
+
+cd "$(dirname "$0")"
+
+LOGDIR=logs
+BENCHDIR=bench
+
+declare -i BASE_PORT=${BASE_PORT:-50000}
+declare -i TRANSLATION_SERVER_PORT=$((${BASE_PORT} + 61))
+declare -i GREETER_SERVER_DEMO_PORT=$((${BASE_PORT} + 71))
+
+LANGUAGES=${LANGUAGES:-cpp}
+QPS=${QPS:-500}
+DURATION_S=${DURATION_S:-30}
+SEED=${SEED:-1}
+TRANSLATOR_CPUS=${TRANSLATOR_CPUS:-0}
+GREETER_CPUS=${GREETER_CPUS:-1}
+CLIENT_CPUS=${CLIENT_CPUS:-2-3}
+RESULTS=${RESULTS:-$LOGDIR/bench_results.txt}
+
+if [[ $1 == -h || $1 == --help ]] ; then
+  _usage
+  exit 0
+fi
+
+declare -i _pid_translator=0 _pid_greeter_demo=0
+
+# Stops the servers of the scenario being run, if any. Every way out of
+# _run calls it, and so does exit, so that a failed or interrupted run
+# leaves no server holding the ports for the next.
+_kill_servers() {
+  [[ $_pid_translator -gt 0 ]] && kill $_pid_translator 2>/dev/null
+  [[ $_pid_greeter_demo -gt 0 ]] && kill $_pid_greeter_demo 2>/dev/null
+  wait 2>/dev/null
+  _pid_translator=0
+  _pid_greeter_demo=0
+}
+
+trap _kill_servers EXIT
+
+_launch() {
+  declare language=$1 scenario=$2
+  declare prefix="$LOGDIR/bench.$language.$scenario"
+  taskset -c "$TRANSLATOR_CPUS" build/translation_server \
+    --port=${TRANSLATION_SERVER_PORT} --behaviour_seed=${SEED} \
+    ${CATALOG:+--catalog="$CATALOG"} \
+    --log_dir="$LOGDIR" \
+    > "$prefix.translation_server.STDOUT" \
+    2> "$prefix.translation_server.STDERR" &
+  _pid_translator=$!
+  declare -a greeter
+  case $language in
+    cpp) greeter=(build/greeter_server_demo --log_dir="$LOGDIR") ;;
+    python) greeter=(build/greeter_server_demo.py --log_dir="$LOGDIR") ;;
+    golang) greeter=(build/go_greeter_server_demo) ;;
+    java) greeter=(java -jar build/greeter-server-demo.jar) ;;
+    *) printf 'Cannot benchmark %s\n' "$language" 1>&2
+       return 1
+       ;;
+  esac
+  taskset -c "$GREETER_CPUS" "${greeter[@]}" \
+    --port=${GREETER_SERVER_DEMO_PORT} \
+    --translation_server=localhost:${TRANSLATION_SERVER_PORT} \
+    > "$prefix.greeter_server_demo.STDOUT" \
+    2> "$prefix.greeter_server_demo.STDERR" &
+  _pid_greeter_demo=$!
+
+  # A call through the greeter succeeds once both servers are serving.
+  declare -i i
+  for i in {1..100} ; do
+    if build/greeter_client \
+         --greeter_server=localhost:${GREETER_SERVER_DEMO_PORT} \
+         --deadline_ms=200 --log_dir="$LOGDIR" 2>/dev/null |
+       grep -q 'Greeting received: [^*]' ; then
+      return 0
+    fi
+    if ! kill -0 $_pid_translator $_pid_greeter_demo 2>/dev/null ; then
+      break
+    fi
+    sleep 0.1
+  done
+  printf 'Servers did not start for %s; see %s.*\n' "$scenario" "$prefix" 1>&2
+  return 1
+}
+
+# Prints the CPU seconds used so far by the process.
+_cpu_seconds() {
+  awk -v hz=$(getconf CLK_TCK) '{ print ($14 + $15) / hz }' "/proc/$1/stat"
+}
+
+# Prints the peak resident set size of the process, in MB.
+_peak_rss_mb() {
+  awk '/^VmHWM:/ { print $2 / 1024 }' "/proc/$1/status"
+}
+
+# Prints one line of results from greeter_client's load report, on stdin.
+_summarize() {
+  awk -v language="$1" -v scenario="$2" -v cpu="$3" -v rss="$4" '
+    /^Finished/ { qps = $6; sub(/^\(/, "", qps) }
+    /^OK:/      { ok = $3; p50 = $5; p90 = $7; p99 = $9; p999 = $11;
+                  max = $13 }
+    /^Failed:/  { failed = $3 }
+    END {
+      gsub(/ms/, "", p50); gsub(/ms/, "", p90); gsub(/ms/, "", p99);
+      gsub(/ms/, "", p999); gsub(/ms/, "", max);
+      printf "%-8s %-20s %8.1f %8d %8d %9s %9s %9s %9s %9s %6.1f %7.1f\n",
+             language, scenario, qps, ok, failed, p50, p90, p99, p999, max,
+             cpu, rss
+    }'
+}
+
+_run() {
+  declare language=$1 scenario=$2
+  declare prefix="$LOGDIR/bench.$language.$scenario"
+  declare definition="$BENCHDIR/$scenario.textproto"
+  if [[ ! -f $definition ]] ; then
+    printf 'No scenario %s\n' "$definition" 1>&2
+    return 1
+  fi
+  _launch "$language" "$scenario" || { _kill_servers ; return 1 ; }
+  build/translation_fanout \
+    --replicas=localhost:${TRANSLATION_SERVER_PORT} \
+    --definition="$definition" --activation_delay_ms=0 \
+    --log_dir="$LOGDIR" > /dev/null || { _kill_servers ; return 1 ; }
+  declare cpu_before=$(_cpu_seconds $_pid_greeter_demo)
+  taskset -c "$CLIENT_CPUS" build/greeter_client \
+    --greeter_server=localhost:${GREETER_SERVER_DEMO_PORT} \
+    --load_qps=${QPS} --load_duration_s=${DURATION_S} \
+    --load_seed=${SEED} \
+    --load_histogram="$prefix.hgrm" \
+    --log_dir="$LOGDIR" \
+    > "$prefix.greeter_client.STDOUT" \
+    2> "$prefix.greeter_client.STDERR"
+  declare -i result=$?
+  # The greeter's CPU use during the load, as a percentage of one CPU.
+  declare cpu=$(awk -v before=$cpu_before \
+                    -v after=$(_cpu_seconds $_pid_greeter_demo) \
+                    -v seconds=$DURATION_S \
+                    'BEGIN { print (after - before) / seconds * 100 }')
+  _summarize "$language" "$scenario" "$cpu" \
+    "$(_peak_rss_mb $_pid_greeter_demo)" < "$prefix.greeter_client.STDOUT"
+  _kill_servers
+  return $result
+}
+
+if [[ $# == 0 ]] ; then
+  set -- $(cd "$BENCHDIR" && ls *.textproto | sed 's/\.textproto$//')
+fi
+
+mkdir -p "$LOGDIR"
+{
+  make -C cpp translation_server greeter_server_demo greeter_client \
+    translation_fanout &&
+  for language in $LANGUAGES ; do
+    make "$language" || exit 1
+  done
+} > "$LOGDIR/bench.make.STDOUT" || exit 1
+
+{
+  printf '# %s qps for %ss, seed %s; translator on CPUs %s, greeter %s, ' \
+    "$QPS" "$DURATION_S" "$SEED" "$TRANSLATOR_CPUS" "$GREETER_CPUS"
+  printf 'client %s\n' "$CLIENT_CPUS"
+  [[ -n $CATALOG ]] && printf '# catalog %s\n' "$CATALOG"
+  printf '%-8s %-20s %8s %8s %8s %9s %9s %9s %9s %9s %6s %7s\n' \
+    '# lang' scenario qps ok failed p50_ms p90_ms p99_ms p99.9_ms max_ms \
+    cpu_% rss_mb
+} > "$RESULTS"
+declare -i failures=0
+for scenario in "$@" ; do
+  for language in $LANGUAGES ; do
+    _run "$language" "$scenario" >> "$RESULTS" || failures=$((failures + 1))
+  done
+done
+cat "$RESULTS"
+exit $failures
@@ -0,0 +1,194 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "catalog_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+
+namespace srecon {
+
+namespace {
+
+// No text is longer, however heavy the length distribution's tail.
+const int kMaxLength = 1 << 16;
+
+// A small, fast generator, so that every row can have a stream of its own.
+class SplitMix64 {
+ public:
+  typedef uint64_t result_type;
+
+  explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Returns the seed of the stream numbered n within the stream seed.
+uint64_t Substream(uint64_t seed, uint64_t n) {
+  return SplitMix64(seed ^ (n * 0x9e3779b97f4a7c15ULL))();
+}
+
+// Ranges of lower case letters, by script.
+const std::pair<char32_t, char32_t> kNonAscii[] = {
+    {0xe0, 0xfe},        // Latin-1: à to þ.
+    {0x3b1, 0x3c9},      // Greek.
+    {0x430, 0x44f},      // Cyrillic.
+    {0x4e00, 0x9fff},    // CJK unified ideographs.
+    {0x1f600, 0x1f64f},  // Emoticons.
+};
+
+void AppendUtf8(char32_t c, std::string* text) {
+  if (c < 0x80) {
+    text->push_back(static_cast<char>(c));
+  } else if (c < 0x800) {
+    text->push_back(static_cast<char>(0xc0 | c >> 6));
+    text->push_back(static_cast<char>(0x80 | (c & 0x3f)));
+  } else if (c < 0x10000) {
+    text->push_back(static_cast<char>(0xe0 | c >> 12));
+    text->push_back(static_cast<char>(0x80 | (c >> 6 & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | (c & 0x3f)));
+  } else {
+    text->push_back(static_cast<char>(0xf0 | c >> 18));
+    text->push_back(static_cast<char>(0x80 | (c >> 12 & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | (c >> 6 & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | (c & 0x3f)));
+  }
+}
+
+}  // namespace
+
+std::string SyntheticLocale(int n) {
+  static const char* const kLanguages[] = {"en", "de", "fr", "es",
+                                           "it", "ja", "pt", "zh"};
+  const int country = n / 8;
+  return std::string(kLanguages[n % 8]) + "_" +
+         static_cast<char>('A' + country / 26 % 26) +
+         static_cast<char>('A' + country % 26);
+}
+
+CatalogGenerator::CatalogGenerator(const CatalogOptions& options)
+    : options_(options),
+      message_length_(LatencyDistribution::Create(options.message_length)),
+      translation_length_(
+          LatencyDistribution::Create(options.translation_length)),
+      width_(std::to_string(std::max<int64_t>(options.messages - 1, 0))
+                 .size()) {}
+
+void CatalogGenerator::AppendText(uint64_t stream,
+                                  const LatencyDistribution* length,
+                                  double mean, std::string* text) const {
+  SplitMix64 urng(stream);
+  const double sampled = length ? length->Sample(urng) : mean;
+  const int characters =
+      static_cast<int>(std::min<double>(std::max(0.0, std::round(sampled)),
+                                        kMaxLength));
+  std::uniform_real_distribution<double> uniform;
+  std::uniform_int_distribution<int> letter('a', 'z' + 1);  // Or a space.
+  std::uniform_int_distribution<size_t> script(
+      0, sizeof(kNonAscii) / sizeof(kNonAscii[0]) - 1);
+  text->reserve(text->size() + characters);
+  for (int i = 0; i < characters; ++i) {
+    if (options_.non_ascii > 0 && uniform(urng) < options_.non_ascii) {
+      const auto& range = kNonAscii[script(urng)];
+      AppendUtf8(std::uniform_int_distribution<uint32_t>(
+                     range.first, range.second)(urng),
+                 text);
+    } else {
+      const int c = letter(urng);
+      text->push_back(c > 'z' ? ' ' : static_cast<char>(c));
+    }
+  }
+}
+
+std::string CatalogGenerator::Message(int64_t n) const {
+  std::string message = std::to_string(n);
+  message.insert(0, std::max<int>(width_ - message.size(), 0), '0');
+  std::string text;
+  AppendText(Substream(Substream(options_.seed, n), 0),
+             message_length_.get(), options_.message_length.mean_ms(),
+             &text);
+  if (!text.empty()) {
+    message += " " + text;
+  }
+  return message;
+}
+
+bool CatalogGenerator::Translation(int64_t n, int l,
+                                   std::string* translation) const {
+  const uint64_t stream = Substream(Substream(options_.seed, n), l + 1);
+  if (options_.coverage < 1) {
+    SplitMix64 urng(stream);
+    if (std::uniform_real_distribution<double>()(urng) >=
+        options_.coverage) {
+      return false;
+    }
+  }
+  translation->clear();
+  AppendText(Substream(stream, 1), translation_length_.get(),
+             options_.translation_length.mean_ms(), translation);
+  return true;
+}
+
+TranslationMap CatalogGenerator::Generate() const {
+  TranslationMap entries;
+  TranslationMap::iterator message = entries.end();
+  ForEachRow([&entries, &message](const AllTranslationsReply& row) {
+    // Messages come in order, so each belongs at the end.
+    if (message == entries.end() || message->first != row.message()) {
+      message = entries.emplace_hint(entries.end(), row.message(),
+                                     TranslationsByLocale());
+    }
+    message->second.emplace(row.locale(), row.translation());
+  });
+  return entries;
+}
+
+}  // namespace srecon
@@ -0,0 +1,122 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_CATALOG_GENERATOR_H_
+#define SRECON_CATALOG_GENERATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "control.pb.h"
+#include "latency_distribution.h"
+#include "translation_catalog.h"
+#include "translator.pb.h"
+
+namespace srecon {
+
+// The number of distinct synthetic locales: 8 languages in 26 * 26
+// countries.
+constexpr int kMaxSyntheticLocales = 8 * 26 * 26;
+
+// Returns a locale such as "en_AB": the nth of every language's. Only the
+// first kMaxSyntheticLocales are distinct.
+std::string SyntheticLocale(int n);
+
+struct CatalogOptions {
+  int64_t messages = 1000;
+  // Locales from SyntheticLocale(0) up, at most kMaxSyntheticLocales, of
+  // which each message has each with probability coverage.
+  int locales = 8;
+  double coverage = 1;
+  // Lengths in characters, read from the distributions' _ms fields, e.g.
+  // "distribution: LOG_NORMAL mean_ms: 40 stddev_ms: 30". Messages also
+  // start with their number, which keeps them distinct.
+  Jitter message_length;
+  Jitter translation_length;
+  // The fraction of characters outside ASCII: accented Latin, Greek,
+  // Cyrillic, CJK and emoji, of two to four bytes in UTF-8.
+  double non_ascii = 0;
+  uint64_t seed = 1;
+};
+
+// Generates a synthetic catalog, of any size, deterministically from its
+// options. Every row can be generated on its own, so that large catalogs
+// need never be held in memory, and clients can know which rows exist.
+class CatalogGenerator {
+ public:
+  explicit CatalogGenerator(const CatalogOptions& options);
+
+  int64_t messages() const { return options_.messages; }
+  int locales() const { return options_.locales; }
+
+  // Returns the text of the nth message. Messages sort by number.
+  std::string Message(int64_t n) const;
+
+  // Returns whether the nth message has the lth locale, and if so sets its
+  // translation.
+  bool Translation(int64_t n, int l, std::string* translation) const;
+
+  // Calls visit(row) with each row, in (message, locale) order.
+  template <typename Visit>
+  void ForEachRow(Visit visit) const {
+    AllTranslationsReply row;
+    for (int64_t n = 0; n < options_.messages; ++n) {
+      row.set_message(Message(n));
+      for (int l = 0; l < options_.locales; ++l) {
+        if (Translation(n, l, row.mutable_translation())) {
+          row.set_locale(SyntheticLocale(l));
+          visit(row);
+        }
+      }
+    }
+  }
+
+  // Returns the whole catalog.
+  TranslationMap Generate() const;
+
+ private:
+  // Appends length characters of random text, from the given stream.
+  void AppendText(uint64_t stream, const LatencyDistribution* length,
+                  double mean, std::string* text) const;
+
+  const CatalogOptions options_;
+  const std::unique_ptr<const LatencyDistribution> message_length_;
+  const std::unique_ptr<const LatencyDistribution> translation_length_;
+  // Digits in the highest message number, to which all are padded.
+  int width_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_CATALOG_GENERATOR_H_
@@ -31,7 +31,10 @@
  *
  */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <sstream>
 #include <vector>
 #include <memory>
 #include <string>
@@ -39,10 +42,14 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <grpc++/grpc++.h>
 
+#include "behaviour_session.h"
 #include "control.grpc.pb.h"
 #include "greeter.grpc.pb.h"
+#include "load_generator.h"
+#include "virtual_clock.h"
 
 DEFINE_string(greeter_server, "localhost:50051",
               "Server address of the greeter server.");
@@ -50,11 +57,38 @@ DEFINE_string(translation_server, "localhost:50061",
               "Server address of the translation server.");
 DEFINE_int32(exercise, 0,
              "Which Exercise to test.");
+DEFINE_string(session, "",
+              "If set, run in this translator behaviour session, so that "
+              "other sessions (and stray requests) can use the same servers "
+              "concurrently. Needs a greeter server which propagates it.");
+DEFINE_bool(virtual_clock, false,
+            "If set, run the test cases in virtual time: injected delays "
+            "pass instantly, but count towards the deadlines as if they had "
+            "been waited for. Needs servers which support it.");
+DEFINE_bool(slo_bursts, false,
+            "If set, also send the test cases' bursts of load, which fail "
+            "if the greeter misses its latency or throughput objective; "
+            "each takes a few seconds. Skipped with --virtual_clock.");
 
 namespace srecon {
 
 // The test cases to be run, by exercise.
 
+// An objective for a test case under load: if qps is set, the case's
+// requests are also sent as a short open-loop burst, with the backend
+// behaving as given, which fails if the greeter misses the objective.
+struct Slo {
+  double qps;             // Calls per second to send (0 means no burst).
+  int duration_ms;        // How long to send them for.
+  const char* behaviour;  // BehaviourDefinition set for the burst.
+  double percentile;      // Which latency percentile is budgeted, e.g. 99.
+  int latency_ms;         // Its budget, from when each call was due.
+  double min_success;     // Fraction of the calls due which must succeed.
+  // For a unary test case, a HelloReply also accepted besides the expected
+  // one, e.g. the default greeting when the backend fails.
+  const char* fallback;
+};
+
 struct UnaryTestCase {
   const char* description;
   const char* request;    // HelloRequest.
@@ -62,6 +96,8 @@ struct UnaryTestCase {
   const char* behaviour;  // Behaviour triggered.
   grpc::StatusCode code;  // Expected outcome
   const char* expected;   // Expected HelloReply if code == OK.
+  int latency_budget_ms;  // Fail if the call takes longer (0 means none).
+  struct Slo slo;
 };
 
 struct StreamTestCase {
@@ -71,6 +107,8 @@ struct StreamTestCase {
   const std::vector<std::string> behaviours;
   const grpc::StatusCode code;
   const std::vector<std::string> expected;
+  int latency_budget_ms;
+  struct Slo slo;
 };
 
 static const std::vector<std::vector<struct UnaryTestCase>> unary_testcases{
@@ -83,7 +121,12 @@ static const std::vector<std::vector<struct UnaryTestCase>> unary_testcases{
      .request = "name:\"SREcon attendee\" locale:\"en_US\"",
      .behaviour = "result: OK",
      .code = grpc::OK,
-     .expected = "message:\"Word up, SREcon attendee!\""},
+     .expected = "message:\"Word up, SREcon attendee!\"",
+     .latency_budget_ms = 500,
+     // The backend's errors may be passed on, but must not slow the rest.
+     .slo = {.qps = 500, .duration_ms = 5000,
+             .behaviour = "unary_rates { probability: 0.01 result: UNKNOWN }",
+             .percentile = 99, .latency_ms = 50, .min_success = 0.98}},
     {.description = "en_GB translation requested",
      .request = "name:\"SREcon attendee\" locale:\"en_GB\"",
      .behaviour = "result: OK",
@@ -147,7 +190,17 @@ static const std::vector<std::vector<struct UnaryTestCase>> unary_testcases{
      .behaviour = "result: OK jitter { mean_ms: 1000 stddev_ms: 200 }",
      .deadline_ms = 1000,
      .code = grpc::DO_NOT_USE,
-     .expected = "message:\"How do you do, SREcon attendee!\""},
+     .expected = "message:\"How do you do, SREcon attendee!\"",
+     // A helpful greeter answers with the default when the backend fails,
+     // rather than fail too.
+     .slo = {.qps = 500, .duration_ms = 5000,
+             .behaviour =
+                 "unary_rates { probability: 0.01 result: UNAVAILABLE } "
+                 "unary_rates { probability: 0.99 result: OK "
+                 "              jitter { distribution: LOG_NORMAL "
+                 "                       mean_ms: 5 stddev_ms: 3 } }",
+             .percentile = 99, .latency_ms = 50, .min_success = 0.999,
+             .fallback = "message:\"Hello, SREcon attendee!\""}},
     {.description = "Potential timeout",
      .request = "name:\"SREcon attendee\" locale:\"en_GB\"",
      .behaviour = "result: OK jitter { mean_ms: 1000 stddev_ms: 200 }",
@@ -206,7 +259,12 @@ static const std::vector<std::vector<struct StreamTestCase>> stream_testcases{
        "message:\"Word up, SREcon attendee!\"",
        "message:\"How do you do, SREcon attendee!\"",
        "message:\"Grüezi, SREcon attendee!\"",
-     }
+     },
+     .latency_budget_ms = 500,
+     .slo = {.qps = 200, .duration_ms = 5000,
+             .behaviour = "stream_rates { probability: 1 result: OK "
+                          "               jitter { mean_ms: 5 } }",
+             .percentile = 99, .latency_ms = 100, .min_success = 0.999}
     },
     {
      .description = "Multiple replies",
@@ -267,9 +325,7 @@ static const std::vector<std::vector<struct StreamTestCase>> stream_testcases{
        "name:\"SREcon attendee\" locale:\"CH\"",
      },
      .behaviours = {
-       "result: OK jitter { mean_ms: 1000 }",
-       "result: OK jitter { mean_ms: 1000 }",
-       "result: OK jitter { mean_ms: 1000 }",
+       "result: OK jitter { mean_ms: 1000 } repeat: 3",
      },
      .code = grpc::DEADLINE_EXCEEDED,
      .expected = {
@@ -284,10 +340,7 @@ static const std::vector<std::vector<struct StreamTestCase>> stream_testcases{
        "name:\"SREcon attendee\" locale:\"CH\"",
      },
      .behaviours = {
-       "result: OK jitter { mean_ms: 1000 }",
-       "result: OK jitter { mean_ms: 1000 }",
-       "result: OK jitter { mean_ms: 1000 }",
-       "result: OK jitter { mean_ms: 1000 }",
+       "result: OK jitter { mean_ms: 1000 } repeat: 4",
      },
      .code = grpc::DEADLINE_EXCEEDED,
      .expected = {
@@ -297,6 +350,142 @@ static const std::vector<std::vector<struct StreamTestCase>> stream_testcases{
   },
 };
 
+// Places the call in the --session, if any.
+void AddSession(grpc::ClientContext* ctx) {
+  if (!FLAGS_session.empty()) {
+    ctx->AddMetadata(kSessionMetadataKey, FLAGS_session);
+  }
+}
+
+// Returns the status of a finished call made in virtual time, which is
+// DEADLINE_EXCEEDED if it took deadline_ms or more of virtual time, as it
+// would have in real time; sets delta to the virtual time taken.
+grpc::Status CheckVirtualDeadline(const grpc::ClientContext& ctx,
+                                  int deadline_ms, const grpc::Status& status,
+                                  std::chrono::milliseconds* delta) {
+  *delta = std::chrono::milliseconds(VirtualElapsedMs(ctx));
+  if (deadline_ms > 0 && delta->count() >= deadline_ms) {
+    return grpc::Status(grpc::DEADLINE_EXCEEDED, "Virtual deadline exceeded");
+  }
+  return status;
+}
+
+// Appends the behaviour in text format to the script, extending the last run
+// if it is the same, so that long scripts stay small.
+void AppendBehaviour(const std::string& text,
+                     google::protobuf::RepeatedPtrField<Behaviour>* script) {
+  Behaviour b;
+  google::protobuf::TextFormat::ParseFromString(text, &b);
+  const uint32_t repeat = std::max<uint32_t>(b.repeat(), 1);
+  if (!script->empty()) {
+    Behaviour* last = script->Mutable(script->size() - 1);
+    const uint32_t last_repeat = std::max<uint32_t>(last->repeat(), 1);
+    // Everything but the repeat count must match, the Match included.
+    last->clear_repeat();
+    b.clear_repeat();
+    if (google::protobuf::util::MessageDifferencer::Equals(*last, b)) {
+      last->set_repeat(last_repeat + repeat);
+      return;
+    }
+    last->set_repeat(last_repeat);
+  }
+  b.set_repeat(repeat);
+  *script->Add() = b;
+}
+
+// A SayHello call of a burst, which fails with DATA_LOSS unless its reply is
+// the one expected, or the fallback if not nullptr, so that wrong answers
+// count against the objective.
+class CheckedHelloCall
+    : public UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply> {
+ public:
+  CheckedHelloCall(Greeter::Stub* stub, const HelloRequest& request,
+                   const HelloReply& expected, const HelloReply* fallback)
+      : UnaryLoadCall(stub, &Greeter::Stub::AsyncSayHello, request),
+        expected_(expected), fallback_(fallback) {}
+
+  bool Proceed(bool ok) override {
+    using google::protobuf::util::MessageDifferencer;
+    if (status_.ok() && !MessageDifferencer::Equals(reply(), expected_) &&
+        !(fallback_ && MessageDifferencer::Equals(reply(), *fallback_))) {
+      status_ = grpc::Status(grpc::DATA_LOSS,
+                             "Unexpected reply " + reply().ShortDebugString());
+    }
+    return true;
+  }
+
+ private:
+  const HelloReply& expected_;
+  const HelloReply* fallback_;
+};
+
+// Sets the slo's backend behaviour, sends its burst of calls made by factory,
+// and returns whether the greeter met the slo; test case i is only named in
+// the log.
+bool RunSloBurst(int i, const char* description, const Slo& slo,
+                 int deadline_ms, TranslatorControl::Stub* control,
+                 const CallFactory& factory) {
+  {
+    BehaviourDefinition def;
+    if (slo.behaviour &&
+        !google::protobuf::TextFormat::ParseFromString(slo.behaviour, &def)) {
+      LOG(ERROR) << "Invalid burst behaviour for test case " << i << ": "
+                 << description << ": " << slo.behaviour;
+      return false;
+    }
+    BehaviourReply unused_reply;
+    grpc::ClientContext ctx;
+    AddSession(&ctx);
+    ctx.set_deadline(std::chrono::system_clock::now() +
+                     std::chrono::seconds(5));
+    grpc::Status status = control->SetBehaviour(&ctx, def, &unused_reply);
+    if (!status.ok()) {
+      LOG(ERROR) << "Unable to set Translator Behaviour for the burst of test "
+                 << "case " << i << ": " << description << ". Request: ["
+                 << def.ShortDebugString() << "] error "
+                 << status.error_code() << " ("
+                 << status.error_message() << ")";
+      return false;
+    }
+  }
+
+  LoadOptions options;
+  options.qps = slo.qps;
+  options.duration = std::chrono::milliseconds(slo.duration_ms);
+  if (deadline_ms > 0) {
+    options.deadline_ms = deadline_ms;
+  }
+  LOG(INFO) << "Sending test case " << i << " at " << slo.qps << " qps for "
+            << slo.duration_ms << "ms.";
+  const LoadResult result = RunOpenLoop(options, factory);
+
+  // Skipped calls count against the objective, as failed: the generator only
+  // skips them when the greeter has fallen far behind.
+  const uint64_t due = result.ok.count() + result.failed.count();
+  const double success = due > 0 ? double(result.ok.count()) / due : 0;
+  const double latency_ms = result.ok.Percentile(slo.percentile) / 1000.0;
+  std::ostringstream summary;
+  summary << "p" << slo.percentile << " " << latency_ms << "ms (budget "
+          << slo.latency_ms << "ms), " << 100 * success << "% of " << due
+          << " calls succeeded (needed " << 100 * slo.min_success
+          << "%). Result:\n";
+  result.Print(&summary);
+  if (latency_ms > slo.latency_ms || success < slo.min_success) {
+    LOG(ERROR) << "Missed objective for test case " << i << ": "
+               << description << " at " << slo.qps << " qps: "
+               << summary.str();
+    return false;
+  }
+  LOG(INFO) << "Met objective for test case " << i << ": " << description
+            << " at " << slo.qps << " qps: " << summary.str();
+  return true;
+}
+
+// Whether to run the burst for slo.
+bool ShouldRunBurst(const Slo& slo) {
+  return FLAGS_slo_bursts && !FLAGS_virtual_clock && slo.qps > 0;
+}
+
 bool RunUnaryTests(int exercise,
                    TranslatorControl::Stub* control,
                    Greeter::Stub* greeter) {
@@ -313,12 +502,12 @@ bool RunUnaryTests(int exercise,
       if (!c.behaviour) {
         continue;
       }
-      google::protobuf::TextFormat::ParseFromString(
-          c.behaviour, def.add_unary());
+      AppendBehaviour(c.behaviour, def.mutable_unary());
     }
     if (def.unary_size() > 0) {
       BehaviourReply unused_reply;
       grpc::ClientContext ctx;
+      AddSession(&ctx);
       ctx.set_deadline(std::chrono::system_clock::now() +
                        std::chrono::seconds(5));
       grpc::Status status = control->SetBehaviour(&ctx, def, &unused_reply);
@@ -341,15 +530,21 @@ bool RunUnaryTests(int exercise,
     google::protobuf::TextFormat::ParseFromString(c.request, &request);
     HelloReply reply;
     grpc::ClientContext ctx;
+    AddSession(&ctx);
 
     auto start_time = std::chrono::system_clock::now();
-    if (c.deadline_ms > 0) {
+    if (FLAGS_virtual_clock) {
+      StartVirtualCall(&ctx, c.deadline_ms);
+    } else if (c.deadline_ms > 0) {
       ctx.set_deadline(start_time +
                        std::chrono::milliseconds(c.deadline_ms));
     }
     grpc::Status status = greeter->SayHello(&ctx, request, &reply);
     auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now() - start_time);
+    if (FLAGS_virtual_clock) {
+      status = CheckVirtualDeadline(ctx, c.deadline_ms, status, &delta);
+    }
 
     if (c.code == grpc::DO_NOT_USE) {
       LOG(INFO) << "Completed test case " << i << ": "
@@ -402,6 +597,44 @@ bool RunUnaryTests(int exercise,
                 << "] failed with code " << c.code << ", took "
                 << delta.count() << "ms.";
     }
+    if (c.latency_budget_ms > 0 && delta.count() > c.latency_budget_ms) {
+      is_ok = false;
+      LOG(ERROR) << "Over latency budget for test case " << i << ": "
+                 << c.description << ".\n\tRequest: [" << c.request
+                 << "] took " << delta.count() << "ms, budget "
+                 << c.latency_budget_ms << "ms.";
+    }
+  }
+  // The bursts run after all the single calls, since each replaces the
+  // behaviours set for them.
+  for (int i = 0; i < cases.size(); ++i) {
+    const struct UnaryTestCase& c = cases[i];
+    if (!ShouldRunBurst(c.slo)) {
+      continue;
+    }
+    HelloRequest request;
+    HelloReply expected;
+    HelloReply fallback;
+    if (!google::protobuf::TextFormat::ParseFromString(c.request, &request) ||
+        !google::protobuf::TextFormat::ParseFromString(c.expected,
+                                                      &expected) ||
+        (c.slo.fallback && !google::protobuf::TextFormat::ParseFromString(
+                               c.slo.fallback, &fallback))) {
+      LOG(ERROR) << "Invalid request or reply for the burst of test case "
+                 << i << ": " << c.description;
+      is_ok = false;
+      continue;
+    }
+    const HelloReply* accepted = c.slo.fallback ? &fallback : nullptr;
+    if (!RunSloBurst(i, c.description, c.slo, c.deadline_ms, control,
+                     [greeter, &request, &expected, accepted]() {
+          std::unique_ptr<LoadCall> call(
+              new CheckedHelloCall(greeter, request, expected, accepted));
+          AddSession(call->context());
+          return call;
+        })) {
+      is_ok = false;
+    }
   }
   return is_ok;
 }
@@ -447,6 +680,38 @@ bool DiffStreamResults(std::vector<std::string> expected,
   return ok;
 }
 
+// A ManyHellos call of a burst, which fails with DATA_LOSS unless its
+// replies are the ones expected, as DiffStreamResults judges them.
+class CheckedHellosCall
+    : public BidiLoadCall<Greeter::Stub, HelloRequest, HelloReply> {
+ public:
+  CheckedHellosCall(Greeter::Stub* stub,
+                    const std::vector<HelloRequest>& requests,
+                    const std::vector<std::string>& expected)
+      : BidiLoadCall(stub, &Greeter::Stub::AsyncManyHellos, requests),
+        expected_(expected) {}
+
+  bool Proceed(bool ok) override {
+    if (!BidiLoadCall::Proceed(ok)) {
+      return false;
+    }
+    std::string diff;
+    if (status_.ok() && !DiffStreamResults(expected_, received_, &diff)) {
+      status_ = grpc::Status(grpc::DATA_LOSS, "Unexpected replies:\n" + diff);
+    }
+    return true;
+  }
+
+ protected:
+  void OnReply(const HelloReply& reply) override {
+    received_.push_back(reply);
+  }
+
+ private:
+  const std::vector<std::string>& expected_;
+  std::vector<HelloReply> received_;
+};
+
 bool RunStreamTests(int exercise,
                     TranslatorControl::Stub* control,
                     Greeter::Stub* greeter) {
@@ -460,12 +725,13 @@ bool RunStreamTests(int exercise,
     BehaviourDefinition def;
     for (const struct StreamTestCase& c : cases) {
       for (const auto& b : c.behaviours) {
-        google::protobuf::TextFormat::ParseFromString(b, def.add_stream());
+        AppendBehaviour(b, def.mutable_stream());
       }
     }
     if (def.stream_size() > 0) {
       BehaviourReply unused_reply;
       grpc::ClientContext ctx;
+      AddSession(&ctx);
       ctx.set_deadline(std::chrono::system_clock::now() +
                        std::chrono::seconds(5));
       grpc::Status status = control->SetBehaviour(&ctx, def, &unused_reply);
@@ -482,9 +748,12 @@ bool RunStreamTests(int exercise,
     const struct StreamTestCase& c = cases[i];
 
     grpc::ClientContext ctx;
+    AddSession(&ctx);
 
     auto start_time = std::chrono::system_clock::now();
-    if (c.deadline_ms > 0) {
+    if (FLAGS_virtual_clock) {
+      StartVirtualCall(&ctx, c.deadline_ms);
+    } else if (c.deadline_ms > 0) {
       ctx.set_deadline(start_time +
                        std::chrono::milliseconds(c.deadline_ms));
     }
@@ -504,7 +773,10 @@ bool RunStreamTests(int exercise,
     grpc::Status status = stream->Finish();
 
     auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
-        start_time - std::chrono::system_clock::now());
+        std::chrono::system_clock::now() - start_time);
+    if (FLAGS_virtual_clock) {
+      status = CheckVirtualDeadline(ctx, c.deadline_ms, status, &delta);
+    }
     std::string message;
     bool replies_ok = DiffStreamResults(c.expected, received, &message);
     if (c.code == grpc::DO_NOT_USE) {
@@ -531,10 +803,63 @@ bool RunStreamTests(int exercise,
                    << "), expected " << c.code << ". Result:\n" << message;
       }
     }
+    if (c.latency_budget_ms > 0 && delta.count() > c.latency_budget_ms) {
+      is_ok = false;
+      LOG(ERROR) << "Over latency budget for test case " << i << ": "
+                 << c.description << ", took " << delta.count()
+                 << "ms, budget " << c.latency_budget_ms << "ms.";
+    }
+  }
+  for (int i = 0; i < cases.size(); ++i) {
+    const struct StreamTestCase& c = cases[i];
+    if (!ShouldRunBurst(c.slo)) {
+      continue;
+    }
+    std::vector<HelloRequest> requests(c.requests.size());
+    bool parsed = true;
+    for (int r = 0; r < c.requests.size(); ++r) {
+      parsed = parsed && google::protobuf::TextFormat::ParseFromString(
+                             c.requests[r], &requests[r]);
+    }
+    if (!parsed) {
+      LOG(ERROR) << "Invalid request for the burst of test case " << i
+                 << ": " << c.description;
+      is_ok = false;
+      continue;
+    }
+    if (!RunSloBurst(i, c.description, c.slo, c.deadline_ms, control,
+                     [greeter, &requests, &c]() {
+          std::unique_ptr<LoadCall> call(
+              new CheckedHellosCall(greeter, requests, c.expected));
+          AddSession(call->context());
+          return call;
+        })) {
+      is_ok = false;
+    }
   }
   return is_ok;
 }
 
+// Removes the --session's behaviour from the translator, if one was used,
+// rather than leaving it to expire.
+void ClearSession(TranslatorControl::Stub* control) {
+  if (FLAGS_session.empty()) {
+    return;
+  }
+  BehaviourDefinition empty;
+  BehaviourReply unused_reply;
+  grpc::ClientContext ctx;
+  AddSession(&ctx);
+  ctx.set_deadline(std::chrono::system_clock::now() +
+                   std::chrono::seconds(5));
+  grpc::Status status = control->SetBehaviour(&ctx, empty, &unused_reply);
+  if (!status.ok()) {
+    LOG(WARNING) << "Unable to clear session " << FLAGS_session << ": error "
+                 << status.error_code() << " (" << status.error_message()
+                 << ")";
+  }
+}
+
 }  // namespace srecon
 
 int main(int argc, char** argv) {
@@ -564,5 +889,6 @@ int main(int argc, char** argv) {
   bool ok =
       RunUnaryTests(FLAGS_exercise, control.get(), greeter.get()) &&
       RunStreamTests(FLAGS_exercise, control.get(), greeter.get());
+  srecon::ClearSession(control.get());
   return ok ? 0 : 1;
 }
@@ -0,0 +1,283 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Finds the knee of the greeter stack's throughput/latency curve. For each
+// method, holds 1, 2, 4, ... concurrent calls outstanding in turn, each for
+// --level_duration_s, replacing each call as soon as it finishes, and
+// writes the rate achieved and latency percentiles at every level as CSV or
+// JSON:
+//
+//   SayHello and ManyHellos  through the greeter, and so the translator;
+//   Translate                straight to the translator; with --catalog,
+//                            of rows drawn from a catalog file.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpc++/grpc++.h>
+
+#include "greeter.grpc.pb.h"
+#include "load_generator.h"
+#include "translation_catalog.h"
+#include "translator.grpc.pb.h"
+
+DEFINE_string(greeter_server, "localhost:50051",
+              "Server address of the greeter server.");
+DEFINE_string(translation_server, "localhost:50061",
+              "Server address of the translation server.");
+DEFINE_string(methods, "SayHello,ManyHellos,Translate",
+              "Comma-separated methods to sweep.");
+DEFINE_string(user, "world", "The user to greet.");
+DEFINE_string(locale, "en_US",
+              "The locale for greetings; ManyHellos asks for its language "
+              "and country separately, as greeter_client does.");
+DEFINE_int32(min_concurrency, 1, "The first level of concurrency.");
+DEFINE_int32(max_concurrency, 4096,
+             "The last level of concurrency; levels double up to it.");
+DEFINE_int32(level_duration_s, 10, "How long to hold each level.");
+DEFINE_int32(threads, 4, "Threads sending calls.");
+DEFINE_int32(deadline_ms, 20*1000, "Deadline per call in milliseconds.");
+DEFINE_string(catalog, "",
+              "If set, a catalog file loaded by the translator, from which "
+              "to draw the messages and locales to Translate, rather than "
+              "always Hello.");
+DEFINE_string(format, "csv", "How to write the results: csv or json.");
+DEFINE_string(output, "-", "Where to write the results; - for stdout.");
+
+namespace srecon {
+
+namespace {
+
+// The result of one level of the sweep.
+struct Level {
+  std::string method;
+  int concurrency;
+  LoadResult result;
+};
+
+// Writes the levels as CSV, with latencies in ms.
+void WriteCsv(const std::vector<Level>& levels, std::ostream* out) {
+  *out << "method,concurrency,qps,ok,failed,p50_ms,p90_ms,p99_ms,p999_ms,"
+          "max_ms\n";
+  for (const Level& level : levels) {
+    const LatencyHistogram& ok = level.result.ok;
+    const double seconds =
+        std::chrono::duration<double>(level.result.elapsed).count();
+    *out << level.method << "," << level.concurrency << ","
+         << (seconds > 0 ? ok.count() / seconds : 0) << "," << ok.count()
+         << "," << level.result.failed.count() << ","
+         << ok.Percentile(50) / 1000.0 << "," << ok.Percentile(90) / 1000.0
+         << "," << ok.Percentile(99) / 1000.0 << ","
+         << ok.Percentile(99.9) / 1000.0 << "," << ok.max() / 1000.0 << "\n";
+  }
+}
+
+// Writes the levels as a JSON array, with the same fields as the CSV.
+void WriteJson(const std::vector<Level>& levels, std::ostream* out) {
+  *out << "[\n";
+  for (size_t i = 0; i < levels.size(); ++i) {
+    const Level& level = levels[i];
+    const LatencyHistogram& ok = level.result.ok;
+    const double seconds =
+        std::chrono::duration<double>(level.result.elapsed).count();
+    *out << "  {\"method\": \"" << level.method << "\", \"concurrency\": "
+         << level.concurrency << ", \"qps\": "
+         << (seconds > 0 ? ok.count() / seconds : 0) << ", \"ok\": "
+         << ok.count() << ", \"failed\": " << level.result.failed.count()
+         << ", \"p50_ms\": " << ok.Percentile(50) / 1000.0
+         << ", \"p90_ms\": " << ok.Percentile(90) / 1000.0
+         << ", \"p99_ms\": " << ok.Percentile(99) / 1000.0
+         << ", \"p999_ms\": " << ok.Percentile(99.9) / 1000.0
+         << ", \"max_ms\": " << ok.max() / 1000.0 << "}"
+         << (i + 1 < levels.size() ? "," : "") << "\n";
+  }
+  *out << "]\n";
+}
+
+}  // namespace
+
+class GreeterBench {
+ public:
+  GreeterBench(std::shared_ptr<grpc::Channel> greeter,
+               std::shared_ptr<grpc::Channel> translator)
+      : greeter_(Greeter::NewStub(greeter)),
+        translator_(Translator::NewStub(translator)), next_(0) {
+    hello_.set_name(FLAGS_user);
+    hello_.set_locale(FLAGS_locale);
+    const size_t separator = FLAGS_locale.find("_");
+    HelloRequest part(hello_);
+    part.set_locale(FLAGS_locale.substr(0, separator));
+    hellos_.push_back(part);
+    if (separator != std::string::npos) {
+      part.set_locale(FLAGS_locale.substr(separator + 1));
+      hellos_.push_back(part);
+    }
+    translations_.emplace_back();
+    translations_.back().set_message("Hello");
+    translations_.back().set_locale(FLAGS_locale);
+  }
+
+  // Translates a uniform sample of the rows of the catalog file, instead of
+  // Hello.
+  grpc::Status SampleCatalog(const std::string& path) {
+    const size_t kSampleSize = 1024;
+    std::vector<TranslationRequest> sample;
+    std::mt19937_64 urng(1);
+    int64_t rows = 0;
+    grpc::Status status = ReadCatalogFile(
+        path, [&sample, &urng, &rows](const AllTranslationsReply& row) {
+          // Reservoir sampling, as the catalog may not fit in memory.
+          size_t i = rows++;
+          if (i >= kSampleSize) {
+            i = std::uniform_int_distribution<int64_t>(0, rows - 1)(urng);
+            if (i >= kSampleSize) {
+              return;
+            }
+          } else {
+            sample.emplace_back();
+          }
+          sample[i].set_message(row.message());
+          sample[i].set_locale(row.locale());
+        });
+    if (status.ok() && sample.empty()) {
+      status = grpc::Status(grpc::INVALID_ARGUMENT, path + " is empty");
+    }
+    if (status.ok()) {
+      translations_.swap(sample);
+    }
+    return status;
+  }
+
+  // Returns the factory for calls of method, or nullptr if it is unknown.
+  CallFactory FactoryFor(const std::string& method) {
+    if (method == "SayHello") {
+      return [this]() {
+        return std::unique_ptr<LoadCall>(
+            new UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+                greeter_.get(), &Greeter::Stub::AsyncSayHello, hello_));
+      };
+    }
+    if (method == "ManyHellos") {
+      return [this]() {
+        return std::unique_ptr<LoadCall>(
+            new BidiLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+                greeter_.get(), &Greeter::Stub::AsyncManyHellos, hellos_));
+      };
+    }
+    if (method == "Translate") {
+      return [this]() {
+        return std::unique_ptr<LoadCall>(
+            new UnaryLoadCall<Translator::Stub, TranslationRequest,
+                              TranslationReply>(
+                translator_.get(), &Translator::Stub::AsyncTranslate,
+                translations_[next_++ % translations_.size()]));
+      };
+    }
+    return nullptr;
+  }
+
+ private:
+  std::unique_ptr<Greeter::Stub> greeter_;
+  std::unique_ptr<Translator::Stub> translator_;
+  HelloRequest hello_;
+  std::vector<HelloRequest> hellos_;
+  std::vector<TranslationRequest> translations_;
+  std::atomic<size_t> next_;
+};
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  srecon::GreeterBench bench(
+      grpc::CreateChannel(FLAGS_greeter_server,
+                          grpc::InsecureChannelCredentials()),
+      grpc::CreateChannel(FLAGS_translation_server,
+                          grpc::InsecureChannelCredentials()));
+  if (!FLAGS_catalog.empty()) {
+    grpc::Status status = bench.SampleCatalog(FLAGS_catalog);
+    if (!status.ok()) {
+      LOG(ERROR) << "Cannot sample --catalog: " << status.error_message();
+      return 1;
+    }
+  }
+  srecon::LoadOptions options;
+  options.duration = std::chrono::seconds(FLAGS_level_duration_s);
+  options.threads = FLAGS_threads;
+  options.deadline_ms = FLAGS_deadline_ms;
+
+  std::vector<srecon::Level> levels;
+  std::istringstream methods(FLAGS_methods);
+  std::string method;
+  while (std::getline(methods, method, ',')) {
+    srecon::CallFactory factory = bench.FactoryFor(method);
+    if (!factory) {
+      LOG(ERROR) << "Unknown method " << method;
+      return 1;
+    }
+    for (int concurrency = std::max(1, FLAGS_min_concurrency);
+         concurrency <= FLAGS_max_concurrency; concurrency *= 2) {
+      srecon::Level level{method, concurrency,
+                          srecon::RunClosedLoop(options, concurrency,
+                                                factory)};
+      LOG(INFO) << method << " at concurrency " << concurrency << ": "
+                << level.result.ok.count() << " OK, "
+                << level.result.failed.count() << " failed.";
+      levels.push_back(std::move(level));
+    }
+  }
+
+  std::ofstream file;
+  if (FLAGS_output != "-") {
+    file.open(FLAGS_output);
+  }
+  std::ostream* out = FLAGS_output == "-" ? &std::cout : &file;
+  if (FLAGS_format == "json") {
+    srecon::WriteJson(levels, out);
+  } else {
+    srecon::WriteCsv(levels, out);
+  }
+  return 0;
+}
@@ -32,8 +32,10 @@
  */
 
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
@@ -43,6 +45,9 @@
 #include <grpc++/grpc++.h>
 
 #include "greeter.grpc.pb.h"
+#include "load_generator.h"
+#include "load_worker.h"
+#include "stream_load.h"
 
 DEFINE_string(user, "world", "The user to greet!");
 DEFINE_string(greeter_server, "localhost:50051",
@@ -53,6 +58,48 @@ DEFINE_bool(wait_for_ready, true,
             "Whether to wait for the backend to become available. "
             "If false, fails fast.");
 DEFINE_bool(streaming, false, "Whether to use the streaming API.");
+DEFINE_double(load_qps, 0,
+              "If positive, instead of greeting once, sends SayHello calls "
+              "at this rate and reports their latencies.");
+DEFINE_int32(load_streams, 0,
+             "If positive, with --streaming, instead of greeting once, "
+             "holds this many ManyHellos streams open and reports their "
+             "latencies. Each request asks for --locale whole, so should "
+             "have one reply.");
+DEFINE_double(load_stream_rate, 1,
+              "How many requests per second each stream sends.");
+DEFINE_int32(load_duration_s, 10, "How long to send calls for.");
+DEFINE_string(load_arrivals, "poisson",
+              "How calls, or requests on a stream, are spaced: poisson or "
+              "constant.");
+DEFINE_int32(load_threads, 2, "Threads sending calls or driving streams.");
+DEFINE_int32(load_max_in_flight, 10000,
+             "Calls outstanding per thread beyond which calls due are "
+             "skipped, counting as failed after the whole deadline.");
+DEFINE_int32(load_seed, 1, "Seed for the Poisson arrivals.");
+DEFINE_string(load_histogram, "",
+              "If set, writes the latency distribution of successful calls, "
+              "or of stream messages, here in HdrHistogram's percentile "
+              "format.");
+DEFINE_int32(load_worker_port, 0,
+             "If positive, instead of greeting, serves on this port as a "
+             "load worker, sending the load that a coordinator asks for.");
+DEFINE_string(load_worker_host, "localhost",
+              "The address on which a load worker listens. Coordinators are "
+              "not authenticated, so only open it up, e.g. with 0.0.0.0, on "
+              "a trusted network.");
+DEFINE_string(load_worker_targets, "",
+              "Comma-separated greeter addresses to which a load worker may "
+              "send load; --greeter_server if empty.");
+DEFINE_string(load_workers, "",
+              "Comma-separated addresses of load workers among which to "
+              "share out --load_qps, rather than sending it all from this "
+              "process, and whose latencies to combine.");
+DEFINE_int32(load_report_interval_ms, 1000,
+             "How often load workers report latencies, which the "
+             "coordinator prints combined.");
+DEFINE_int32(load_start_delay_ms, 1000,
+             "How long from now load workers start, all together.");
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -61,6 +108,24 @@ using grpc::Status;
 using srecon::HelloRequest;
 using srecon::HelloReply;
 using srecon::Greeter;
+using srecon::LoadCall;
+using srecon::LoadOptions;
+using srecon::LoadResult;
+using srecon::StreamLoadOptions;
+using srecon::StreamLoadResult;
+
+// Splits a comma-separated flag, skipping empty entries.
+std::vector<std::string> SplitList(const std::string& list) {
+  std::vector<std::string> entries;
+  std::istringstream stream(list);
+  std::string entry;
+  while (std::getline(stream, entry, ',')) {
+    if (!entry.empty()) {
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
 
 class GreeterClient {
  public:
@@ -183,15 +248,114 @@ class GreeterClient {
     return replies;
   }
 
+  // Holds ManyHellos streams for user open as set by the --load flags, each
+  // sending requests at --load_stream_rate, and returns the latencies seen.
+  StreamLoadResult ManyHellosLoad(const std::string& user) {
+    HelloRequest request;
+    request.set_name(user);
+    request.set_locale(FLAGS_locale);
+
+    StreamLoadOptions options;
+    options.streams = FLAGS_load_streams;
+    options.messages_per_second = FLAGS_load_stream_rate;
+    options.arrivals = FLAGS_load_arrivals == "constant"
+                           ? LoadOptions::CONSTANT
+                           : LoadOptions::POISSON;
+    options.duration = std::chrono::seconds(FLAGS_load_duration_s);
+    options.threads = FLAGS_load_threads;
+    options.deadline_ms = FLAGS_deadline_ms;
+    options.seed = FLAGS_load_seed;
+    LOG(INFO) << "Holding " << options.streams << " streams open for "
+              << FLAGS_load_duration_s << "s.";
+    return srecon::RunHelloStreams(stub_.get(), request, options);
+  }
+
+  // Has the --load_workers send SayHello calls for user at the rate and for
+  // the time set by the --load flags, sharing the rate out among them, and
+  // sets result to their combined latencies. Returns false if any failed.
+  static bool SayHelloLoadDistributed(const std::string& user,
+                                      LoadResult* result) {
+    const std::vector<std::string> workers = SplitList(FLAGS_load_workers);
+    srecon::LoadRequest load;
+    load.set_greeter_server(FLAGS_greeter_server);
+    load.mutable_request()->set_name(user);
+    load.mutable_request()->set_locale(FLAGS_locale);
+    load.set_qps(FLAGS_load_qps);
+    load.set_constant_arrivals(FLAGS_load_arrivals == "constant");
+    load.set_duration_ms(FLAGS_load_duration_s * 1000);
+    load.set_threads(FLAGS_load_threads);
+    load.set_max_in_flight(FLAGS_load_max_in_flight);
+    load.set_deadline_ms(FLAGS_deadline_ms);
+    load.set_seed(FLAGS_load_seed);
+    load.set_report_interval_ms(FLAGS_load_report_interval_ms);
+    load.set_wait_for_ready(FLAGS_wait_for_ready);
+    LOG(INFO) << "Sending " << load.qps() << " qps for "
+              << FLAGS_load_duration_s << "s from " << workers.size()
+              << " workers.";
+    return srecon::RunDistributed(workers, load, FLAGS_load_start_delay_ms,
+                                  &std::cout, result)
+        .ok();
+  }
+
+  // Sends SayHello calls for user at the rate and for the time set by the
+  // --load flags, and returns the latencies seen.
+  LoadResult SayHelloLoad(const std::string& user) {
+    HelloRequest request;
+    request.set_name(user);
+    request.set_locale(FLAGS_locale);
+
+    LoadOptions options;
+    options.qps = FLAGS_load_qps;
+    options.arrivals = FLAGS_load_arrivals == "constant"
+                           ? LoadOptions::CONSTANT
+                           : LoadOptions::POISSON;
+    options.duration = std::chrono::seconds(FLAGS_load_duration_s);
+    options.threads = FLAGS_load_threads;
+    options.max_in_flight = FLAGS_load_max_in_flight;
+    options.deadline_ms = FLAGS_deadline_ms;
+    options.seed = FLAGS_load_seed;
+    LOG(INFO) << "Sending " << options.qps << " qps for "
+              << FLAGS_load_duration_s << "s.";
+    return srecon::RunOpenLoop(options, [this, &request]() {
+      std::unique_ptr<LoadCall> call(
+          new srecon::UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+              stub_.get(), &Greeter::Stub::AsyncSayHello, request));
+      call->context()->set_wait_for_ready(FLAGS_wait_for_ready);
+      return call;
+    });
+  }
+
  private:
   std::unique_ptr<Greeter::Stub> stub_;
 };
 
+// Serves as a load worker on --load_worker_port until killed.
+void RunLoadWorker() {
+  const std::string address =
+      FLAGS_load_worker_host + ":" + std::to_string(FLAGS_load_worker_port);
+  std::vector<std::string> targets = SplitList(FLAGS_load_worker_targets);
+  if (targets.empty()) {
+    targets.push_back(FLAGS_greeter_server);
+  }
+  srecon::LoadWorkerImpl service(std::move(targets));
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  LOG(INFO) << "Load worker listening on " << address;
+  server->Wait();
+}
+
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
   std::string user = (argc > 1 ? argv[1] : FLAGS_user);
 
+  if (FLAGS_load_worker_port > 0) {
+    RunLoadWorker();
+    return 0;
+  }
+
   // Instantiate the client. It requires a channel, out of which the actual RPCs
   // are created. This channel models a connection to an endpoint (in this case,
   // by default localhost at port 50051). We indicate that the channel isn't
@@ -199,7 +363,30 @@ int main(int argc, char** argv) {
   GreeterClient greeter(grpc::CreateChannel(
       FLAGS_greeter_server, grpc::InsecureChannelCredentials()));
 
-  if (FLAGS_streaming) {
+  if (FLAGS_streaming && FLAGS_load_streams > 0) {
+    StreamLoadResult result = greeter.ManyHellosLoad(user);
+    result.Print(&std::cout);
+    if (!FLAGS_load_histogram.empty()) {
+      std::ofstream histogram(FLAGS_load_histogram);
+      result.message.PrintPercentiles(&histogram);
+    }
+  } else if (FLAGS_load_qps > 0) {
+    if (FLAGS_streaming) {
+      LOG(ERROR) << "Streaming load is set by --load_streams.";
+      return 1;
+    }
+    LoadResult result;
+    if (FLAGS_load_workers.empty()) {
+      result = greeter.SayHelloLoad(user);
+    } else if (!GreeterClient::SayHelloLoadDistributed(user, &result)) {
+      return 1;
+    }
+    result.Print(&std::cout);
+    if (!FLAGS_load_histogram.empty()) {
+      std::ofstream histogram(FLAGS_load_histogram);
+      result.ok.PrintPercentiles(&histogram);
+    }
+  } else if (FLAGS_streaming) {
     std::vector<std::string> replies = greeter.AllTheHellos(user);
     LOG(INFO) << "Received " << replies.size() << " replies";
     for (const std::string& greeting : replies) {
@@ -0,0 +1,300 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Replays a log of greeter requests at its recorded pace, or faster or
+// slower by --speed, open-loop with as many calls in flight as it takes,
+// and reports their latencies overall, by locale, and by method. Each line
+// of the log is
+//
+//   offset_ms,name,locale,streaming
+//
+// with the request's arrival time from the start of the log, its
+// HelloRequest, and 1 if it was a ManyHellos stream, or 0 (or nothing) if
+// it was a SayHello call. Streams send the locale's language and country
+// separately, as greeter_client --streaming does. Lines must be in order of
+// offset; empty lines and '#' comments are skipped.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpc++/grpc++.h>
+
+#include "greeter.grpc.pb.h"
+#include "load_generator.h"
+
+DEFINE_string(greeter_server, "localhost:50051",
+              "Server address of the greeter server.");
+DEFINE_string(log, "-", "The request log to replay; - for standard input.");
+DEFINE_double(speed, 1,
+              "How many times faster than recorded to replay the log.");
+DEFINE_int32(threads, 4, "Threads sending calls.");
+DEFINE_int32(max_in_flight, 10000,
+             "Calls outstanding per thread beyond which calls due are "
+             "skipped, counting as failed after the whole deadline.");
+DEFINE_int32(deadline_ms, 20*1000, "Deadline per call in milliseconds.");
+DEFINE_string(histogram, "",
+              "If set, writes the latency distribution of successful calls "
+              "here in HdrHistogram's percentile format.");
+
+namespace srecon {
+
+namespace {
+
+// The requests of a log, each kept once however often it recurs.
+class RequestLog {
+ public:
+  // Reads the log from in, returning false if it is malformed.
+  bool Read(std::istream& in) {
+    std::string line;
+    int64_t last_offset_us = 0;
+    for (int line_number = 1; std::getline(in, line); ++line_number) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      if (!Parse(line, last_offset_us)) {
+        LOG(ERROR) << "Line " << line_number << " is malformed or out of "
+                   << "order: " << line;
+        return false;
+      }
+      last_offset_us = calls_.back().offset.count();
+    }
+    return true;
+  }
+
+  const std::vector<ScheduledCall>& calls() const { return calls_; }
+  const std::vector<std::string>& locales() const { return locales_; }
+
+  // Labels are the locale's index, twice, plus 1 for streams.
+  static bool IsStream(int label) { return label % 2 == 1; }
+  const std::string& LocaleOf(int label) const {
+    return locales_[label / 2];
+  }
+
+  // The request of the ith call, and the requests its stream sends if it is
+  // a ManyHellos call.
+  const HelloRequest& unary(size_t i) const {
+    return requests_[request_of_[i]].first;
+  }
+  const std::vector<HelloRequest>& stream(size_t i) const {
+    return requests_[request_of_[i]].second;
+  }
+
+ private:
+  bool Parse(const std::string& line, int64_t last_offset_us) {
+    std::istringstream fields(line);
+    std::string offset_ms, name, locale, streaming;
+    if (!std::getline(fields, offset_ms, ',') ||
+        !std::getline(fields, name, ',') ||
+        !std::getline(fields, locale, ',')) {
+      return false;
+    }
+    std::getline(fields, streaming);
+    char* end;
+    const double offset = std::strtod(offset_ms.c_str(), &end);
+    if (*end != '\0' || !(offset >= 0) ||
+        std::llround(offset * 1000) < last_offset_us) {
+      return false;
+    }
+    if (streaming != "" && streaming != "0" && streaming != "1") {
+      return false;
+    }
+
+    auto inserted = locale_index_.emplace(locale, locales_.size());
+    if (inserted.second) {
+      locales_.push_back(locale);
+    }
+    calls_.push_back(ScheduledCall{
+        std::chrono::microseconds(std::llround(offset * 1000)),
+        static_cast<int>(inserted.first->second * 2 +
+                         (streaming == "1" ? 1 : 0))});
+    request_of_.push_back(RequestFor(name, locale));
+    return true;
+  }
+
+  // Returns the index of the requests for name and locale, adding them if
+  // they are new.
+  size_t RequestFor(const std::string& name, const std::string& locale) {
+    auto inserted = request_index_.emplace(std::make_pair(name, locale),
+                                           requests_.size());
+    if (inserted.second) {
+      HelloRequest request;
+      request.set_name(name);
+      request.set_locale(locale);
+      std::vector<HelloRequest> parts;
+      const size_t separator = locale.find("_");
+      HelloRequest part(request);
+      part.set_locale(locale.substr(0, separator));
+      parts.push_back(part);
+      if (separator != std::string::npos) {
+        part.set_locale(locale.substr(separator + 1));
+        parts.push_back(part);
+      }
+      requests_.emplace_back(request, parts);
+    }
+    return inserted.first->second;
+  }
+
+  std::vector<ScheduledCall> calls_;
+  std::vector<size_t> request_of_;
+  std::vector<std::pair<HelloRequest, std::vector<HelloRequest>>> requests_;
+  std::map<std::pair<std::string, std::string>, size_t> request_index_;
+  std::vector<std::string> locales_;
+  std::map<std::string, size_t> locale_index_;
+};
+
+// Writes one line of the results of a group of calls.
+void PrintGroup(const std::string& name, const LoadResult& result,
+                std::ostream* out) {
+  *out << "  " << std::left << std::setw(12) << name << std::right
+       << " OK: ";
+  result.ok.PrintSummary(out);
+  *out << " failed " << result.failed.count();
+  for (const auto& error : result.errors) {
+    *out << " code " << error.first << ": " << error.second;
+  }
+  if (result.skipped > 0) {
+    *out << " (" << result.skipped << " skipped)";
+  }
+  *out << "\n";
+}
+
+}  // namespace
+
+class GreeterReplay {
+ public:
+  GreeterReplay(std::shared_ptr<grpc::Channel> channel, const RequestLog* log)
+      : stub_(Greeter::NewStub(channel)), log_(log) {}
+
+  // Replays the log, printing the results to out.
+  LoadResult Run(std::ostream* out) {
+    LoadOptions options;
+    options.threads = FLAGS_threads;
+    options.max_in_flight = FLAGS_max_in_flight;
+    options.deadline_ms = FLAGS_deadline_ms;
+    std::vector<LoadResult> by_label;
+    LoadResult total = RunSchedule(
+        options, log_->calls(), FLAGS_speed,
+        [this](size_t i) {
+          if (RequestLog::IsStream(log_->calls()[i].label)) {
+            return std::unique_ptr<LoadCall>(
+                new BidiLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+                    stub_.get(), &Greeter::Stub::AsyncManyHellos,
+                    log_->stream(i)));
+          }
+          return std::unique_ptr<LoadCall>(
+              new UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+                  stub_.get(), &Greeter::Stub::AsyncSayHello,
+                  log_->unary(i)));
+        },
+        &by_label);
+
+    std::map<std::string, LoadResult> by_locale;
+    LoadResult by_method[2];
+    for (size_t label = 0; label < by_label.size(); ++label) {
+      by_locale[log_->LocaleOf(label)].Merge(by_label[label]);
+      by_method[RequestLog::IsStream(label)].Merge(by_label[label]);
+    }
+
+    total.Print(out);
+    *out << "By locale:\n";
+    for (const auto& locale : by_locale) {
+      PrintGroup(locale.first, locale.second, out);
+    }
+    *out << "By method:\n";
+    PrintGroup("SayHello", by_method[0], out);
+    PrintGroup("ManyHellos", by_method[1], out);
+    return total;
+  }
+
+ private:
+  std::unique_ptr<Greeter::Stub> stub_;
+  const RequestLog* log_;
+};
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (!(FLAGS_speed > 0)) {
+    LOG(ERROR) << "--speed must be positive.";
+    return 1;
+  }
+  srecon::RequestLog log;
+  if (FLAGS_log == "-") {
+    if (!log.Read(std::cin)) {
+      return 1;
+    }
+  } else {
+    std::ifstream in(FLAGS_log);
+    if (!in) {
+      LOG(ERROR) << "Cannot open " << FLAGS_log;
+      return 1;
+    }
+    if (!log.Read(in)) {
+      return 1;
+    }
+  }
+  if (log.calls().empty()) {
+    LOG(ERROR) << "The log has no requests.";
+    return 1;
+  }
+  LOG(INFO) << "Replaying " << log.calls().size() << " requests, spanning "
+            << log.calls().back().offset.count() / 1000 << "ms, in "
+            << log.locales().size() << " locales at " << FLAGS_speed
+            << "x.";
+
+  srecon::GreeterReplay replay(
+      grpc::CreateChannel(FLAGS_greeter_server,
+                          grpc::InsecureChannelCredentials()),
+      &log);
+  srecon::LoadResult result = replay.Run(&std::cout);
+  if (!FLAGS_histogram.empty()) {
+    std::ofstream histogram(FLAGS_histogram);
+    result.ok.PrintPercentiles(&histogram);
+  }
+  return 0;
+}
@@ -41,8 +41,11 @@
 #include <glog/logging.h>
 #include <grpc++/grpc++.h>
 
+#include "behaviour_session.h"
 #include "greeter.grpc.pb.h"
+#include "greeting.h"
 #include "translator.grpc.pb.h"
+#include "virtual_clock.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -59,6 +62,21 @@ DEFINE_int32(deadline_ms, 20*1000, "Default deadline in milliseconds.");
 
 namespace srecon {
 
+namespace {
+
+void PropagateSession(const ServerContext& context,
+                      ClientContext* t_context) {
+  const auto& metadata = context.client_metadata();
+  auto session = metadata.find(kSessionMetadataKey);
+  if (session != metadata.end()) {
+    t_context->AddMetadata(
+        kSessionMetadataKey,
+        std::string(session->second.data(), session->second.size()));
+  }
+}
+
+}  // namespace
+
 // Logic and data behind the server's behavior.
 class GreeterServiceImpl final : public Greeter::Service {
  public:
@@ -67,6 +85,8 @@ class GreeterServiceImpl final : public Greeter::Service {
 
   Status SayHello(ServerContext* context, const HelloRequest* request,
                   HelloReply* reply) override {
+    // Reports the virtual time taken, if the call is made in virtual time.
+    VirtualCall clock(context);
     std::string prefix("Hello");
 
     TranslationRequest t_request;
@@ -79,6 +99,7 @@ class GreeterServiceImpl final : public Greeter::Service {
     // and gRPC will use that for the propagated values.
     std::unique_ptr<ClientContext> t_context =
         ClientContext::FromServerContext(*context);
+    PropagateSession(*context, t_context.get());
     t_context->set_wait_for_ready(false);
     // Set the default deadline if not set by the client.
     if (context->deadline() ==
@@ -89,9 +110,15 @@ class GreeterServiceImpl final : public Greeter::Service {
       LOG(INFO) << "Default deadline was set.";
     t_context->set_deadline(default_deadline);
     }
+    if (clock.enabled()) {
+      // Likewise in virtual time.
+      clock.Propagate(t_context.get(),
+                      clock.has_deadline() ? 0 : FLAGS_deadline_ms);
+    }
 
     auto start_time = std::chrono::system_clock::now();
     Status status = stub_->Translate(t_context.get(), t_request, &t_reply);
+    clock.AdvanceBy(*t_context);
     auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now() - start_time);
     LOG(INFO) << "Call to Translator Backend took " << delta.count() << "ms.";
@@ -105,12 +132,13 @@ class GreeterServiceImpl final : public Greeter::Service {
                  << " (returning default to caller).";
     }
 
-    reply->set_message(prefix + ", " + request->name() + "!");
+    reply->set_message(AssembleGreeting(prefix, request->name()));
     return Status::OK;
   }
 
   Status ManyHellos(ServerContext* context,
                     ServerReaderWriter<HelloReply, HelloRequest>* stream) override {
+    VirtualCall clock(context);
     bool ok = false;
     HelloRequest request;
     while (stream->Read(&request)) {
@@ -124,6 +152,10 @@ class GreeterServiceImpl final : public Greeter::Service {
       // call, so setting the deadline makes little sense.
       std::unique_ptr<ClientContext> t_context =
           ClientContext::FromServerContext(*context);
+      PropagateSession(*context, t_context.get());
+      if (clock.enabled()) {
+        clock.Propagate(t_context.get(), 0);
+      }
       auto start_time = std::chrono::system_clock::now();
       auto t_stream = stub_->AllTranslations(t_context.get(), t_request);
 
@@ -138,7 +170,8 @@ class GreeterServiceImpl final : public Greeter::Service {
                   << "after " << delta.count() << "ms.";
         found = true;
         HelloReply reply;
-        reply.set_message(t_reply.translation() + ", " + request.name() + "!");
+        reply.set_message(
+            AssembleGreeting(t_reply.translation(), request.name()));
         // Check whether the client still cares (don't so work if, say, their
         // caller's deadline has expired):
         if (context->IsCancelled()) {
@@ -150,6 +183,7 @@ class GreeterServiceImpl final : public Greeter::Service {
         stream->Write(reply);
       }
       Status t_status = t_stream->Finish();
+      clock.AdvanceBy(*t_context);
       if (!t_status.ok()) {
         return t_status;
       }
@@ -0,0 +1,275 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "latency_distribution.h"
+
+namespace srecon {
+
+namespace {
+
+// Quantiles are tabulated for probabilities within [kMinU, kMaxU]; the
+// extreme tails are capped there rather than reaching infinity.
+constexpr double kTailStart = 0.99;
+constexpr double kMinU = 1e-6;
+constexpr double kMaxU = 1 - 1e-6;
+
+// Inverse of the standard normal CDF, by Acklam's rational approximation
+// (relative error below 1.2e-9).
+double NormalQuantile(double p) {
+  static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                             -2.759285104469687e+02, 1.383577518672690e+02,
+                             -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                             -1.556989798598866e+02, 6.680131188771972e+01,
+                             -1.328068155288572e+01};
+  static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                             -2.400758277161838e+00, -2.549732539343734e+00,
+                             4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                             2.445134137142996e+00, 3.754408661907416e+00};
+  const double p_low = 0.02425;
+  if (p < p_low) {
+    double q = std::sqrt(-2 * std::log(p));
+    return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+            c[5]) /
+           ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }
+  if (p > 1 - p_low) {
+    return -NormalQuantile(1 - p);
+  }
+  double q = p - 0.5;
+  double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r +
+          a[5]) * q /
+         (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+// Bounds a tabulated quantile to [0, kMaxDelayMs]; a NaN becomes 0.
+double ClampDelay(double delay_ms) {
+  return delay_ms > 0 ? std::min(delay_ms, kMaxDelayMs) : 0;
+}
+
+// Looks up u in a table of quantiles at evenly spaced probabilities from
+// u_begin to u_end, interpolating linearly.
+template <size_t N>
+double Interpolate(const std::array<double, N>& table, double u_begin,
+                   double u_end, double u) {
+  double x = (u - u_begin) / (u_end - u_begin) * (N - 1);
+  x = std::max(0.0, std::min(x, static_cast<double>(N - 1)));
+  size_t i = std::min(static_cast<size_t>(x), N - 2);
+  double frac = x - i;
+  return table[i] + frac * (table[i + 1] - table[i]);
+}
+
+}  // namespace
+
+template <typename Quantile>
+void LatencyDistribution::AddComponent(double weight, Quantile quantile) {
+  Table table;
+  for (int i = 0; i <= kBodySize; ++i) {
+    double u = kTailStart * i / kBodySize;
+    table.body[i] = ClampDelay(quantile(std::max(kMinU, u)));
+  }
+  for (int i = 0; i <= kTailSize; ++i) {
+    double u = kTailStart + (1 - kTailStart) * i / kTailSize;
+    table.tail[i] = ClampDelay(quantile(std::min(kMaxU, u)));
+  }
+  components_.push_back(table);
+  weights_.push_back(weight);
+}
+
+void LatencyDistribution::Finish() {
+  // Vose's alias method: each slot holds its own component with
+  // alias_probability_, and otherwise its alias.
+  const size_t n = weights_.size();
+  double total = 0;
+  for (double w : weights_) {
+    total += w;
+  }
+  std::vector<double> scaled(n);
+  std::vector<int> small, large;
+  for (size_t i = 0; i < n; ++i) {
+    scaled[i] = weights_[i] * n / total;
+    (scaled[i] < 1 ? small : large).push_back(i);
+  }
+  alias_probability_.assign(n, 1.0);
+  alias_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    alias_[i] = i;
+  }
+  while (!small.empty() && !large.empty()) {
+    int s = small.back();
+    small.pop_back();
+    int l = large.back();
+    alias_probability_[s] = scaled[s];
+    alias_[s] = l;
+    scaled[l] -= 1 - scaled[s];
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+}
+
+std::unique_ptr<const LatencyDistribution> LatencyDistribution::Create(
+    const Jitter& jitter) {
+  std::unique_ptr<LatencyDistribution> d(new LatencyDistribution);
+  std::ostringstream description;
+  const double mean = jitter.mean_ms();
+  const double stddev = jitter.stddev_ms();
+  switch (jitter.distribution()) {
+    case Jitter::LOG_NORMAL: {
+      if (mean <= 0) {
+        return nullptr;
+      }
+      const double sigma2 = std::log(1 + (stddev * stddev) / (mean * mean));
+      const double mu = std::log(mean) - sigma2 / 2;
+      const double sigma = std::sqrt(sigma2);
+      d->AddComponent(1, [mu, sigma](double u) {
+        return std::exp(mu + sigma * NormalQuantile(u));
+      });
+      description << "log-normal, mean " << mean << "ms, stddev " << stddev
+                  << "ms";
+      break;
+    }
+    case Jitter::EXPONENTIAL:
+      if (mean <= 0) {
+        return nullptr;
+      }
+      d->AddComponent(1, [mean](double u) { return -mean * std::log(1 - u); });
+      description << "exponential, mean " << mean << "ms";
+      break;
+    case Jitter::PARETO: {
+      const double scale = jitter.scale_ms();
+      const double shape = jitter.shape();
+      if (scale <= 0 || shape <= 0) {
+        return nullptr;
+      }
+      d->AddComponent(1, [scale, shape](double u) {
+        return scale / std::pow(1 - u, 1 / shape);
+      });
+      description << "pareto, scale " << scale << "ms, shape " << shape;
+      break;
+    }
+    case Jitter::BIMODAL: {
+      const double p = std::max(0.0, std::min(1.0,
+                                              jitter.second_probability()));
+      const double mean2 = jitter.second_mean_ms();
+      const double stddev2 = jitter.second_stddev_ms();
+      d->AddComponent(1 - p, [mean, stddev](double u) {
+        return mean + stddev * NormalQuantile(u);
+      });
+      d->AddComponent(p, [mean2, stddev2](double u) {
+        return mean2 + stddev2 * NormalQuantile(u);
+      });
+      description << "bimodal, " << mean << "ms (stddev " << stddev << "ms), "
+                  << "or with probability " << p << ", " << mean2
+                  << "ms (stddev " << stddev2 << "ms)";
+      break;
+    }
+    case Jitter::EMPIRICAL: {
+      // Piecewise linear CDF through the given points, from the last
+      // leading point with cumulative 0 (the minimum delay), or else from
+      // (0, 0).
+      std::vector<Jitter::CdfPoint> points(1);
+      for (const auto& point : jitter.cdf()) {
+        if (points.size() == 1 && point.cumulative() <= 0) {
+          points[0].set_latency_ms(
+              std::max(points[0].latency_ms(), point.latency_ms()));
+        } else if (point.cumulative() > points.back().cumulative() &&
+            point.latency_ms() >= points.back().latency_ms()) {
+          points.push_back(point);
+        }
+      }
+      if (points.size() < 2) {
+        return nullptr;
+      }
+      const double top = points.back().cumulative();
+      d->AddComponent(1, [points, top](double u) {
+        double target = u * top;
+        auto next = std::lower_bound(
+            points.begin() + 1, points.end(), target,
+            [](const Jitter::CdfPoint& p, double c) {
+              return p.cumulative() < c;
+            });
+        if (next == points.end()) {
+          return points.back().latency_ms();
+        }
+        const Jitter::CdfPoint& prev = *(next - 1);
+        double frac = (target - prev.cumulative()) /
+                      (next->cumulative() - prev.cumulative());
+        return prev.latency_ms() +
+               frac * (next->latency_ms() - prev.latency_ms());
+      });
+      description << "empirical, " << points.size() - 1 << " points up to "
+                  << points.back().latency_ms() << "ms";
+      break;
+    }
+    case Jitter::NORMAL:
+    default:
+      if (mean <= 0) {
+        return nullptr;
+      }
+      d->AddComponent(1, [mean, stddev](double u) {
+        return mean + stddev * NormalQuantile(u);
+      });
+      description << "normal, mean " << mean << "ms, stddev " << stddev
+                  << "ms";
+      break;
+  }
+  d->Finish();
+  d->description_ = description.str();
+  return std::unique_ptr<const LatencyDistribution>(d.release());
+}
+
+double LatencyDistribution::Sample(double u_component, double u) const {
+  size_t component = 0;
+  if (components_.size() > 1) {
+    double x = u_component * components_.size();
+    component = std::min(static_cast<size_t>(x), components_.size() - 1);
+    if (x - component >= alias_probability_[component]) {
+      component = alias_[component];
+    }
+  }
+  const Table& table = components_[component];
+  if (u < kTailStart) {
+    return Interpolate(table.body, 0, kTailStart, u);
+  }
+  return Interpolate(table.tail, kTailStart, 1, u);
+}
+
+}  // namespace srecon
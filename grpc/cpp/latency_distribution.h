@@ -0,0 +1,105 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_LATENCY_DISTRIBUTION_H_
+#define SRECON_LATENCY_DISTRIBUTION_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "control.pb.h"
+
+namespace srecon {
+
+// The longest delay a distribution yields, 1 hour: far beyond any deadline,
+// and it keeps heavy tails (say Pareto with shape 0.1) finite.
+constexpr double kMaxDelayMs = 60 * 60 * 1000;
+
+// A delay distribution compiled from a Jitter definition into lookup
+// tables, so that sampling takes constant time however heavy the tail.
+//
+// Each component distribution is tabulated as its inverse CDF, with a
+// second, finer table for the top percentile; mixtures pick a component by
+// Vose's alias method.
+class LatencyDistribution {
+ public:
+  // Returns nullptr if the jitter adds no delay.
+  static std::unique_ptr<const LatencyDistribution> Create(
+      const Jitter& jitter);
+
+  // Returns a delay in ms, in [0, kMaxDelayMs], from two independent uniform
+  // variates in [0, 1): one to choose a component, one for the quantile.
+  double Sample(double u_component, double u) const;
+
+  template <typename URNG>
+  double Sample(URNG& urng) const {
+    std::uniform_real_distribution<double> uniform;
+    return Sample(components_.size() > 1 ? uniform(urng) : 0, uniform(urng));
+  }
+
+  const std::string& description() const { return description_; }
+
+ private:
+  static const int kBodySize = 1024;
+  static const int kTailSize = 1024;
+
+  // Inverse CDF of one component: quantiles at evenly spaced probabilities
+  // in [0, kTailStart] and (kTailStart, 1).
+  struct Table {
+    std::array<double, kBodySize + 1> body;
+    std::array<double, kTailSize + 1> tail;
+  };
+
+  LatencyDistribution() = default;
+
+  // Tabulates the given quantile function.
+  template <typename Quantile>
+  void AddComponent(double weight, Quantile quantile);
+
+  // Builds the alias table from the components' weights.
+  void Finish();
+
+  std::vector<Table> components_;
+  std::vector<double> weights_;
+  std::vector<double> alias_probability_;
+  std::vector<int> alias_;
+  std::string description_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_LATENCY_DISTRIBUTION_H_
@@ -0,0 +1,181 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <utility>
+
+#include "latency_histogram.h"
+
+namespace srecon {
+
+namespace {
+
+// Returns the position of the highest bit set in value, which is positive.
+int HighestBit(uint64_t value) {
+  return 63 - __builtin_clzll(value);
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : count_(0), min_(std::numeric_limits<int64_t>::max()), max_(0),
+      sum_(0) {}
+
+int LatencyHistogram::BucketOf(int64_t micros) {
+  if (micros < kSubBuckets) {
+    return micros;
+  }
+  // Keep the top kSubBucketBits - 1 bits below the highest.
+  const int shift = HighestBit(micros) - (kSubBucketBits - 1);
+  return kSubBuckets + (shift - 1) * (kSubBuckets / 2) +
+         ((micros >> shift) - kSubBuckets / 2);
+}
+
+int64_t LatencyHistogram::HighestIn(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  const int shift = (bucket - kSubBuckets) / (kSubBuckets / 2) + 1;
+  const int64_t top = (bucket - kSubBuckets) % (kSubBuckets / 2) +
+                      kSubBuckets / 2;
+  return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(int64_t micros) {
+  micros = std::max<int64_t>(0, micros);
+  const int bucket = BucketOf(micros);
+  if (static_cast<size_t>(bucket) >= counts_.size()) {
+    counts_.resize(bucket + 1);
+  }
+  ++counts_[bucket];
+  ++count_;
+  min_ = std::min(min_, micros);
+  max_ = std::max(max_, micros);
+  sum_ += micros;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  if (other.counts_.size() > counts_.size()) {
+    counts_.resize(other.counts_.size());
+  }
+  for (size_t i = 0; i < other.counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  sum_ += other.sum_;
+}
+
+LatencyHistogram LatencyHistogram::FromState(std::vector<uint64_t> counts,
+                                             int64_t min, int64_t max,
+                                             int64_t sum) {
+  LatencyHistogram histogram;
+  histogram.counts_ = std::move(counts);
+  for (uint64_t count : histogram.counts_) {
+    histogram.count_ += count;
+  }
+  if (histogram.count_ > 0) {
+    histogram.min_ = min;
+    histogram.max_ = max;
+    histogram.sum_ = sum;
+  }
+  return histogram;
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  // The rank of the value wanted, counting from 1.
+  const uint64_t rank = std::max<uint64_t>(
+      1, std::ceil(std::min(100.0, percentile) / 100 * count_));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(HighestIn(i), max_);
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::PrintPercentiles(std::ostream* out) const {
+  *out << std::setw(12) << "Value" << " " << std::setw(14) << "Percentile"
+       << " " << std::setw(10) << "TotalCount" << " " << std::setw(16)
+       << "1/(1-Percentile)" << "\n\n" << std::fixed;
+  uint64_t seen = 0;
+  size_t bucket = 0;
+  // Reports the value at percentile p (as a fraction).
+  auto report = [&](double p) {
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(p * count_));
+    while (bucket < counts_.size() && seen < rank) {
+      seen += counts_[bucket++];
+    }
+    const int64_t value =
+        bucket > 0 ? std::min(HighestIn(bucket - 1), max_) : 0;
+    *out << std::setprecision(3) << std::setw(12) << value / 1000.0 << " "
+         << std::setprecision(12) << std::setw(14) << p << " "
+         << std::setw(10) << seen << " ";
+    if (p < 1) {
+      *out << std::setprecision(2) << std::setw(16) << 1 / (1 - p);
+    }
+    *out << "\n";
+  };
+  // Five steps to each halving of the distance to 100%, as HdrHistogram
+  // reports, until the highest value is reached.
+  for (double half = 0; count_ > 0 && seen < count_ && half < 1 - 1e-9;
+       half += (1 - half) / 2) {
+    for (int step = 0; step < 5 && seen < count_; ++step) {
+      report(half + (1 - half) / 2 * step / 5);
+    }
+  }
+  report(1);
+  out->unsetf(std::ios::floatfield);
+  *out << std::setprecision(6) << "#[Mean    = " << mean() / 1000
+       << ", Max     = " << max_ / 1000.0 << "]\n"
+       << "#[Total count    = " << count_ << "]\n";
+}
+
+void LatencyHistogram::PrintSummary(std::ostream* out) const {
+  *out << "count " << count_;
+  for (double p : {50.0, 90.0, 99.0, 99.9}) {
+    *out << " p" << p << " " << Percentile(p) / 1000.0 << "ms";
+  }
+  *out << " max " << max_ / 1000.0 << "ms";
+}
+
+}  // namespace srecon
@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_LATENCY_HISTOGRAM_H_
+#define SRECON_LATENCY_HISTOGRAM_H_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace srecon {
+
+// A histogram of latencies in microseconds, after HdrHistogram: buckets are
+// exact below kSubBuckets, and above that kSubBuckets / 2 to each power of
+// two, so every value is kept to within 1/64 (1.6%) of itself whatever its
+// magnitude. Recording takes constant time and no allocation once the
+// histogram has grown to its largest value. Histograms recorded separately,
+// e.g. one per thread, merge exactly.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Record(int64_t micros);
+  void Merge(const LatencyHistogram& other);
+
+  // Returns the value below which the given percentile (0 to 100) of the
+  // values recorded fall, or 0 if there are none. Reports the top of a
+  // bucket, so never under-reports; the 100th percentile is the exact max.
+  int64_t Percentile(double percentile) const;
+
+  uint64_t count() const { return count_; }
+  int64_t min() const { return count_ > 0 ? min_ : 0; }
+  int64_t max() const { return max_; }
+  double mean() const { return count_ > 0 ? double(sum_) / count_ : 0; }
+
+  // Writes the percentile distribution in HdrHistogram's text form, as read
+  // by its plotter, with values in ms.
+  void PrintPercentiles(std::ostream* out) const;
+
+  // Writes one line: the count and the usual percentiles in ms.
+  void PrintSummary(std::ostream* out) const;
+
+  // The raw state, from which FromState() rebuilds the same histogram, e.g.
+  // to merge histograms recorded by other processes.
+  const std::vector<uint64_t>& counts() const { return counts_; }
+  int64_t sum() const { return sum_; }
+  static LatencyHistogram FromState(std::vector<uint64_t> counts,
+                                    int64_t min, int64_t max, int64_t sum);
+
+ private:
+  static const int kSubBucketBits = 7;
+  static const int64_t kSubBuckets = 1 << kSubBucketBits;
+
+  static int BucketOf(int64_t micros);
+  // The largest value that falls in the bucket.
+  static int64_t HighestIn(int bucket);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_;
+  int64_t min_;
+  int64_t max_;
+  int64_t sum_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,120 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "latency_trace.h"
+
+namespace srecon {
+
+const char kTraceMagic[8] = {'S', 'R', 'T', 'R', 'A', 'C', 'E', '\0'};
+
+std::unique_ptr<const LatencyTrace> LatencyTrace::Open(
+    const std::string& path, std::string* error) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = path + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    *error = path + ": " + strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    *error = path + ": not a regular file";
+    close(fd);
+    return nullptr;
+  }
+  const size_t map_size = st.st_size;
+  if (map_size < sizeof(TraceHeader) ||
+      (map_size - sizeof(TraceHeader)) % sizeof(TraceRecord) != 0) {
+    *error = path + ": not a whole number of trace records";
+    close(fd);
+    return nullptr;
+  }
+  void* map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid without the descriptor.
+  close(fd);
+  if (map == MAP_FAILED) {
+    *error = path + ": " + strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<const LatencyTrace> trace(
+      new LatencyTrace(path, map, map_size));
+  const TraceHeader* header = static_cast<const TraceHeader*>(map);
+  if (memcmp(header->magic, kTraceMagic, sizeof(kTraceMagic)) != 0 ||
+      header->version != kTraceVersion ||
+      header->record_size != sizeof(TraceRecord)) {
+    *error = path + ": not a version " + std::to_string(kTraceVersion) +
+             " trace file";
+    return nullptr;
+  }
+  // Replay mostly moves forward through the file: read ahead, and let the
+  // pages behind go.
+  madvise(map, map_size, MADV_SEQUENTIAL);
+  return trace;
+}
+
+LatencyTrace::LatencyTrace(const std::string& path, void* map,
+                           size_t map_size)
+    : path_(path), map_(map), map_size_(map_size),
+      records_(reinterpret_cast<const TraceRecord*>(
+          static_cast<const char*>(map) + sizeof(TraceHeader))),
+      size_((map_size - sizeof(TraceHeader)) / sizeof(TraceRecord)) {}
+
+LatencyTrace::~LatencyTrace() {
+  munmap(map_, map_size_);
+}
+
+size_t LatencyTrace::Find(uint64_t offset_us) const {
+  const TraceRecord* next = std::upper_bound(
+      records_, records_ + size_, offset_us,
+      [](uint64_t offset_us, const TraceRecord& record) {
+        return offset_us < record.offset_us;
+      });
+  if (next == records_) {
+    return size_;
+  }
+  return next - records_ - 1;
+}
+
+}  // namespace srecon
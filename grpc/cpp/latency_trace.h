@@ -0,0 +1,101 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_LATENCY_TRACE_H_
+#define SRECON_LATENCY_TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace srecon {
+
+// A recorded trace of calls to a backend, replayed as injected behaviour.
+//
+// The file is a TraceHeader followed by TraceRecords in order of offset,
+// in host byte order (little-endian on x86 and ARM), so it can be mapped
+// into memory and used in place: opening it reads only the header, however
+// large the file, and replaying it keeps just the pages in use resident.
+// trace_convert writes them from CSV.
+struct TraceHeader {
+  char magic[8];     // kTraceMagic
+  uint32_t version;  // kTraceVersion
+  uint32_t record_size;
+};
+
+struct TraceRecord {
+  uint64_t offset_us;   // When the call arrived, from the start of the trace.
+  uint32_t latency_us;  // How long it took.
+  int32_t status;       // Its canonical status code.
+};
+
+static_assert(sizeof(TraceHeader) == 16, "TraceHeader must be packed");
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must be packed");
+
+extern const char kTraceMagic[8];
+constexpr uint32_t kTraceVersion = 1;
+
+class LatencyTrace {
+ public:
+  // Maps the trace file at path, or returns nullptr, setting error.
+  static std::unique_ptr<const LatencyTrace> Open(const std::string& path,
+                                                  std::string* error);
+
+  ~LatencyTrace();
+
+  LatencyTrace(const LatencyTrace&) = delete;
+  LatencyTrace& operator=(const LatencyTrace&) = delete;
+
+  size_t size() const { return size_; }
+  const TraceRecord& operator[](size_t i) const { return records_[i]; }
+
+  // Returns the index of the last record at or before offset_us, or size()
+  // if the trace starts later.
+  size_t Find(uint64_t offset_us) const;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  LatencyTrace(const std::string& path, void* map, size_t map_size);
+
+  std::string path_;
+  void* map_;
+  size_t map_size_;
+  const TraceRecord* records_;
+  size_t size_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_LATENCY_TRACE_H_
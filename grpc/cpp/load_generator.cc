@@ -0,0 +1,432 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "load_generator.h"
+
+namespace srecon {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// How often a thread waiting for completions checks options.cancelled.
+constexpr std::chrono::milliseconds kCancelledPoll(100);
+
+// A call in flight, as tagged on the completion queue.
+struct Issued {
+  std::unique_ptr<LoadCall> call;
+  Clock::time_point due;
+  int label;  // Or -1 for none.
+};
+
+// The calls a thread has in flight on its completion queue.
+typedef std::unordered_set<Issued*> Outstanding;
+
+// Starts a call due at due, with a deadline from now.
+void Issue(const LoadOptions& options, std::unique_ptr<LoadCall> call,
+           Clock::time_point due, int label, grpc::CompletionQueue* cq,
+           Outstanding* outstanding) {
+  Issued* issued = new Issued{std::move(call), due, label};
+  issued->call->context()->set_deadline(
+      std::chrono::system_clock::now() +
+      std::chrono::milliseconds(options.deadline_ms));
+  outstanding->insert(issued);
+  issued->call->Start(cq, issued);
+}
+
+void Record(const grpc::Status& status, int64_t latency,
+            LoadResult* result) {
+  if (status.ok()) {
+    result->ok.Record(latency);
+  } else {
+    result->failed.Record(latency);
+    ++result->errors[status.error_code()];
+  }
+}
+
+// Records a call due but not sent, because max_in_flight were outstanding,
+// as failed after its whole deadline: its caller would have waited that long
+// for nothing, and leaving it out would flatter the latencies just when the
+// server falls behind.
+void RecordSkipped(const LoadOptions& options, LoadResult* result) {
+  result->failed.Record(int64_t{options.deadline_ms} * 1000);
+  ++result->skipped;
+}
+
+// Takes the next step of the call tagged tag. Returns true, having recorded
+// its latency and deleted it, if it has finished. The latency is also
+// recorded by the call's label in by_label, if given.
+bool Proceed(void* tag, bool ok, Outstanding* outstanding,
+             LoadResult* result,
+             std::vector<LoadResult>* by_label = nullptr) {
+  Issued* issued = static_cast<Issued*>(tag);
+  if (!issued->call->Proceed(ok)) {
+    return false;
+  }
+  const int64_t latency = Micros(Clock::now() - issued->due);
+  Record(issued->call->status(), latency, result);
+  if (by_label != nullptr && issued->label >= 0) {
+    Record(issued->call->status(), latency, &(*by_label)[issued->label]);
+  }
+  outstanding->erase(issued);
+  delete issued;
+  return true;
+}
+
+// Cancels the calls still outstanding, and shuts down cq. No call takes
+// another step: each has one operation pending, which the cancellation
+// completes at once, and starting another on a queue being shut down is not
+// allowed. Each is recorded, also by label in by_label if given, as failed
+// with DEADLINE_EXCEEDED after its whole deadline, which is as long as its
+// caller could have waited; as with skipped calls, leaving them out would
+// flatter the latencies.
+void Drain(const LoadOptions& options, grpc::CompletionQueue* cq,
+           Outstanding* outstanding, LoadResult* result,
+           std::vector<LoadResult>* by_label = nullptr) {
+  const grpc::Status abandoned(grpc::DEADLINE_EXCEEDED, "Abandoned");
+  const int64_t latency = int64_t{options.deadline_ms} * 1000;
+  for (Issued* issued : *outstanding) {
+    issued->call->context()->TryCancel();
+    Record(abandoned, latency, result);
+    if (by_label != nullptr && issued->label >= 0) {
+      Record(abandoned, latency, &(*by_label)[issued->label]);
+    }
+  }
+  cq->Shutdown();
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+  }
+  for (Issued* issued : *outstanding) {
+    delete issued;
+  }
+  outstanding->clear();
+}
+
+// Issues one thread's share of the calls, on its own completion queue.
+LoadResult RunOpenLoopThread(const LoadOptions& options,
+                            const CallFactory& factory, int thread) {
+  LoadResult result;
+  // With options.report, calls are recorded here until reported.
+  LoadResult interval;
+  LoadResult* const record = options.report ? &interval : &result;
+  std::mt19937 urng(options.seed + thread);
+  const double rate = options.qps / options.threads;
+  std::exponential_distribution<double> poisson_gap(rate);
+  auto gap = [&]() {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(
+            options.arrivals == LoadOptions::POISSON ? poisson_gap(urng)
+                                                     : 1 / rate));
+  };
+
+  grpc::CompletionQueue cq;
+  Outstanding outstanding;
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + options.duration;
+  // Constant arrivals are staggered across the threads.
+  Clock::time_point due =
+      options.arrivals == LoadOptions::POISSON
+          ? start + gap()
+          : start + gap() * thread / options.threads;
+  Clock::time_point next_report = start + options.report_interval;
+  auto report = [&options, &result, &interval]() {
+    result.Merge(interval);
+    options.report(interval);
+    interval = LoadResult();
+  };
+  int in_flight = 0;
+  while (due < end || in_flight > 0) {
+    if (options.cancelled && options.cancelled()) {
+      LOG(INFO) << "Cancelled, with " << in_flight << " calls in flight.";
+      break;
+    }
+    Clock::time_point now = Clock::now();
+    if (options.report && now >= next_report) {
+      report();
+      next_report += options.report_interval;
+    }
+    if (due < end && due <= now) {
+      if (in_flight >= options.max_in_flight) {
+        RecordSkipped(options, record);
+      } else {
+        Issue(options, factory(), due, -1, &cq, &outstanding);
+        record->send_lag.Record(Micros(now - due));
+        ++in_flight;
+      }
+      due += gap();
+      continue;
+    }
+
+    // Wait for a completion until the next call is due, or once all are
+    // sent, until the last has had time to finish.
+    const Clock::time_point limit =
+        due < end ? due
+                  : end + std::chrono::milliseconds(options.deadline_ms) +
+                        kDrainSlack;
+    // Or until the next report, or the next check for cancellation.
+    Clock::time_point until =
+        options.report ? std::min(limit, next_report) : limit;
+    if (options.cancelled) {
+      until = std::min(until, now + kCancelledPoll);
+    }
+    void* tag;
+    bool ok;
+    const grpc::CompletionQueue::NextStatus next = cq.AsyncNext(
+        &tag, &ok, std::chrono::system_clock::now() + (until - now));
+    if (next == grpc::CompletionQueue::TIMEOUT) {
+      if (due >= end && until == limit) {
+        LOG(ERROR) << in_flight << " calls never finished.";
+        break;
+      }
+      continue;
+    }
+    CHECK(next == grpc::CompletionQueue::GOT_EVENT);
+    if (Proceed(tag, ok, &outstanding, record)) {
+      --in_flight;
+    }
+  }
+  result.elapsed = Clock::now() - start;
+  Drain(options, &cq, &outstanding, record);
+  if (options.report) {
+    report();
+  }
+  return result;
+}
+
+// Keeps concurrency calls outstanding on a completion queue of its own.
+LoadResult RunClosedLoopThread(const LoadOptions& options, int concurrency,
+                               const CallFactory& factory) {
+  LoadResult result;
+  grpc::CompletionQueue cq;
+  Outstanding outstanding;
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + options.duration;
+  for (int i = 0; i < concurrency; ++i) {
+    Issue(options, factory(), Clock::now(), -1, &cq, &outstanding);
+  }
+  int in_flight = concurrency;
+  const auto drain_deadline =
+      std::chrono::system_clock::now() + options.duration +
+      std::chrono::milliseconds(options.deadline_ms) + kDrainSlack;
+  while (in_flight > 0) {
+    void* tag;
+    bool ok;
+    const grpc::CompletionQueue::NextStatus next =
+        cq.AsyncNext(&tag, &ok, drain_deadline);
+    if (next == grpc::CompletionQueue::TIMEOUT) {
+      LOG(ERROR) << in_flight << " calls never finished.";
+      break;
+    }
+    CHECK(next == grpc::CompletionQueue::GOT_EVENT);
+    if (!Proceed(tag, ok, &outstanding, &result)) {
+      continue;
+    }
+    const Clock::time_point now = Clock::now();
+    if (now < end) {
+      Issue(options, factory(), now, -1, &cq, &outstanding);
+    } else {
+      --in_flight;
+    }
+  }
+  result.elapsed = Clock::now() - start;
+  Drain(options, &cq, &outstanding, &result);
+  return result;
+}
+
+// Issues every options.threads-th call of the schedule, from the thread-th,
+// on a completion queue of its own.
+LoadResult RunScheduleThread(const LoadOptions& options,
+                             const std::vector<ScheduledCall>& calls,
+                             double speed, const ScheduledCallFactory& factory,
+                             Clock::time_point start, int thread,
+                             std::vector<LoadResult>* by_label) {
+  LoadResult result;
+  auto due_of = [&calls, speed, start](size_t i) {
+    return start + std::chrono::duration_cast<Clock::duration>(
+                       calls[i].offset / speed);
+  };
+
+  grpc::CompletionQueue cq;
+  Outstanding outstanding;
+  size_t next = thread;
+  int in_flight = 0;
+  // Once all are sent, when to give up on the last to finish.
+  Clock::time_point drain_end = Clock::time_point::max();
+  while (next < calls.size() || in_flight > 0) {
+    Clock::time_point now = Clock::now();
+    const Clock::time_point due =
+        next < calls.size() ? due_of(next) : Clock::time_point::max();
+    if (due <= now) {
+      if (in_flight >= options.max_in_flight) {
+        RecordSkipped(options, &result);
+        RecordSkipped(options, &(*by_label)[calls[next].label]);
+      } else {
+        Issue(options, factory(next), due, calls[next].label, &cq,
+              &outstanding);
+        result.send_lag.Record(Micros(now - due));
+        ++in_flight;
+      }
+      next += options.threads;
+      if (next >= calls.size()) {
+        drain_end = now + std::chrono::milliseconds(options.deadline_ms) +
+                    kDrainSlack;
+      }
+      continue;
+    }
+
+    // Wait for a completion until the next call is due, or once all are
+    // sent, until the last has had time to finish.
+    const Clock::time_point until = next < calls.size() ? due : drain_end;
+    void* tag;
+    bool ok;
+    const grpc::CompletionQueue::NextStatus next_status = cq.AsyncNext(
+        &tag, &ok, std::chrono::system_clock::now() + (until - now));
+    if (next_status == grpc::CompletionQueue::TIMEOUT) {
+      if (next >= calls.size()) {
+        LOG(ERROR) << in_flight << " calls never finished.";
+        break;
+      }
+      continue;
+    }
+    CHECK(next_status == grpc::CompletionQueue::GOT_EVENT);
+    if (Proceed(tag, ok, &outstanding, &result, by_label)) {
+      --in_flight;
+    }
+  }
+  result.elapsed = Clock::now() - start;
+  Drain(options, &cq, &outstanding, &result, by_label);
+  return result;
+}
+
+}  // namespace
+
+int64_t Micros(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+void LoadResult::Merge(const LoadResult& other) {
+  ok.Merge(other.ok);
+  failed.Merge(other.failed);
+  send_lag.Merge(other.send_lag);
+  for (const auto& error : other.errors) {
+    errors[error.first] += error.second;
+  }
+  skipped += other.skipped;
+  elapsed = std::max(elapsed, other.elapsed);
+}
+
+void LoadResult::Print(std::ostream* out) const {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  const uint64_t finished = ok.count() + failed.count() - skipped;
+  *out << "Finished " << finished << " calls in " << seconds << "s ("
+       << (seconds > 0 ? finished / seconds : 0) << " qps), " << skipped
+       << " skipped (counted as failed at the deadline).\n";
+  *out << "OK: ";
+  ok.PrintSummary(out);
+  *out << "\nFailed: ";
+  failed.PrintSummary(out);
+  for (const auto& error : errors) {
+    *out << " code " << error.first << ": " << error.second;
+  }
+  *out << "\nSend lag: ";
+  send_lag.PrintSummary(out);
+  *out << "\n";
+}
+
+LoadResult RunOpenLoop(const LoadOptions& options,
+                       const CallFactory& factory) {
+  CHECK_GT(options.qps, 0);
+  CHECK_GT(options.threads, 0);
+  return RunThreads(options.threads, [&options, &factory](int i) {
+    return RunOpenLoopThread(options, factory, i);
+  });
+}
+
+LoadResult RunClosedLoop(const LoadOptions& options, int concurrency,
+                         const CallFactory& factory) {
+  CHECK_GT(concurrency, 0);
+  const int threads = std::max(1, std::min(options.threads, concurrency));
+  return RunThreads(threads, [&options, concurrency, threads,
+                              &factory](int i) {
+    // Share the calls out as evenly as possible.
+    return RunClosedLoopThread(
+        options, concurrency / threads + (i < concurrency % threads ? 1 : 0),
+        factory);
+  });
+}
+
+LoadResult RunSchedule(const LoadOptions& options,
+                       const std::vector<ScheduledCall>& calls, double speed,
+                       const ScheduledCallFactory& factory,
+                       std::vector<LoadResult>* by_label) {
+  CHECK_GT(speed, 0);
+  CHECK_GT(options.threads, 0);
+  int labels = 0;
+  for (const ScheduledCall& call : calls) {
+    CHECK_GE(call.label, 0);
+    labels = std::max(labels, call.label + 1);
+  }
+  // Each thread records by label separately, to merge at the end.
+  std::vector<std::vector<LoadResult>> thread_labels(
+      options.threads, std::vector<LoadResult>(labels));
+  // All the threads share one start, so that the calls keep their order.
+  const Clock::time_point start = Clock::now();
+  LoadResult total = RunThreads(
+      options.threads,
+      [&options, &calls, speed, &factory, start, &thread_labels](int i) {
+        return RunScheduleThread(options, calls, speed, factory, start, i,
+                                 &thread_labels[i]);
+      });
+  by_label->assign(labels, LoadResult());
+  for (const std::vector<LoadResult>& results : thread_labels) {
+    for (int l = 0; l < labels; ++l) {
+      (*by_label)[l].Merge(results[l]);
+    }
+  }
+  for (LoadResult& result : *by_label) {
+    result.elapsed = total.elapsed;
+  }
+  return total;
+}
+
+}  // namespace srecon
@@ -0,0 +1,280 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_LOAD_GENERATOR_H_
+#define SRECON_LOAD_GENERATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include <grpc++/grpc++.h>
+
+#include "latency_histogram.h"
+
+namespace srecon {
+
+// One call issued by a LoadGenerator, on a completion queue.
+class LoadCall {
+ public:
+  virtual ~LoadCall() {}
+
+  // Starts the call on cq. Each of its steps completes with tag.
+  virtual void Start(grpc::CompletionQueue* cq, void* tag) = 0;
+
+  // Called as each step completes; returns true once the call has finished
+  // and status() is its result, or otherwise starts the next step.
+  virtual bool Proceed(bool ok) { return true; }
+
+  grpc::ClientContext* context() { return &context_; }
+  const grpc::Status& status() const { return status_; }
+
+ protected:
+  grpc::ClientContext context_;
+  grpc::Status status_;
+};
+
+// A unary call of any method, e.g.
+//   UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+//       stub, &Greeter::Stub::AsyncSayHello, request)
+// The stub and request must outlive the call.
+template <typename Stub, typename Request, typename Reply>
+class UnaryLoadCall : public LoadCall {
+ public:
+  typedef std::unique_ptr<grpc::ClientAsyncResponseReader<Reply>> (
+      Stub::*Method)(grpc::ClientContext*, const Request&,
+                     grpc::CompletionQueue*);
+
+  UnaryLoadCall(Stub* stub, Method method, const Request& request)
+      : stub_(stub), method_(method), request_(request) {}
+
+  void Start(grpc::CompletionQueue* cq, void* tag) override {
+    reader_ = (stub_->*method_)(&context_, request_, cq);
+    reader_->Finish(&reply_, &status_, tag);
+  }
+
+  // Once the call has finished OK.
+  const Reply& reply() const { return reply_; }
+
+ private:
+  Stub* stub_;
+  Method method_;
+  const Request& request_;
+  Reply reply_;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<Reply>> reader_;
+};
+
+// A bidirectional streaming call, e.g. of ManyHellos, which writes all the
+// requests, then reads all the replies. The stub and requests must outlive
+// the call.
+template <typename Stub, typename Request, typename Reply>
+class BidiLoadCall : public LoadCall {
+ public:
+  typedef std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Reply>> (
+      Stub::*Method)(grpc::ClientContext*, grpc::CompletionQueue*, void*);
+
+  BidiLoadCall(Stub* stub, Method method,
+               const std::vector<Request>& requests)
+      : stub_(stub), method_(method), requests_(requests), written_(0),
+        step_(WRITING), reading_(false) {}
+
+  void Start(grpc::CompletionQueue* cq, void* tag) override {
+    tag_ = tag;
+    stream_ = (stub_->*method_)(&context_, cq, tag);
+  }
+
+  bool Proceed(bool ok) override {
+    if (step_ == FINISHING) {
+      return true;
+    }
+    if (!ok) {
+      // The replies have ended, or the stream has failed.
+      step_ = FINISHING;
+      stream_->Finish(&status_, tag_);
+    } else if (step_ == WRITING && written_ < requests_.size()) {
+      stream_->Write(requests_[written_++], tag_);
+    } else if (step_ == WRITING) {
+      step_ = READING;
+      stream_->WritesDone(tag_);
+    } else {
+      if (reading_) {
+        OnReply(reply_);
+      }
+      reading_ = true;
+      stream_->Read(&reply_, tag_);
+    }
+    return false;
+  }
+
+ protected:
+  // Called with each reply read, e.g. to check it.
+  virtual void OnReply(const Reply& reply) {}
+
+ private:
+  enum Step { WRITING, READING, FINISHING };
+
+  Stub* stub_;
+  Method method_;
+  const std::vector<Request>& requests_;
+  size_t written_;
+  Step step_;
+  // Whether a read has been started, so that reply_ holds what it read.
+  bool reading_;
+  void* tag_;
+  Reply reply_;
+  std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Reply>> stream_;
+};
+
+// Creates the next call to issue. Called from all the generator's threads.
+typedef std::function<std::unique_ptr<LoadCall>()> CallFactory;
+
+struct LoadResult;
+
+struct LoadOptions {
+  enum Arrivals { CONSTANT, POISSON };
+
+  double qps = 100;
+  Arrivals arrivals = POISSON;
+  std::chrono::milliseconds duration = std::chrono::seconds(10);
+  // Threads issuing calls, each with its own completion queue and a share
+  // of the rate.
+  int threads = 2;
+  // Calls due while this many are outstanding on a thread are skipped, and
+  // count as failed after deadline_ms.
+  int max_in_flight = 10000;
+  int deadline_ms = 20 * 1000;
+  uint32_t seed = 1;
+  // If set, RunOpenLoop's threads each call it every report_interval with
+  // the result of the calls finished since their last report, and once more
+  // when they finish; so from all the threads at once.
+  std::function<void(const LoadResult&)> report;
+  std::chrono::milliseconds report_interval = std::chrono::seconds(1);
+  // If set, RunOpenLoop's threads poll it, from all the threads at once, and
+  // once it returns true stop early, cancelling the calls in flight (which
+  // count as failed after deadline_ms).
+  std::function<bool()> cancelled;
+};
+
+struct LoadResult {
+  void Merge(const LoadResult& other);
+
+  // Writes the rates achieved and the latency percentiles.
+  void Print(std::ostream* out) const;
+
+  // Latencies in microseconds, from when each call was due to be sent, so
+  // that a server slow enough to hold up the generator is charged for the
+  // wait it caused.
+  LatencyHistogram ok;
+  // Including the skipped calls, and those abandoned unfinished, as taking
+  // the whole deadline.
+  LatencyHistogram failed;
+  // How late each call was sent, which should stay well under the
+  // latencies measured if the generator is keeping up.
+  LatencyHistogram send_lag;
+  // The number of failed calls by status code.
+  std::map<int, uint64_t> errors;
+  // Calls due but not sent, because max_in_flight were outstanding; they are
+  // also in failed, though not in errors.
+  uint64_t skipped = 0;
+  std::chrono::steady_clock::duration elapsed{};
+};
+
+// Issues calls at options.qps for options.duration, open-loop: each call is
+// sent when due, however many are still outstanding, rather than waiting
+// for earlier calls to finish as a closed-loop client would. Returns once
+// every call has finished.
+LoadResult RunOpenLoop(const LoadOptions& options, const CallFactory& factory);
+
+// Keeps concurrency calls outstanding for options.duration, closed-loop:
+// each call is replaced as soon as it finishes, so the rate achieved is
+// what the server sustains at that concurrency. Latencies are from when
+// each call was sent; options.qps and arrivals are ignored.
+LoadResult RunClosedLoop(const LoadOptions& options, int concurrency,
+                         const CallFactory& factory);
+
+// A call for RunSchedule to issue.
+struct ScheduledCall {
+  // When it is due, from the start of the run.
+  std::chrono::microseconds offset;
+  // Which of the results by label to record it in as well as the total.
+  int label;
+};
+
+// Creates the ith call of a schedule. Called from all the threads.
+typedef std::function<std::unique_ptr<LoadCall>(size_t i)>
+    ScheduledCallFactory;
+
+// Issues each of calls, which must be in order of offset, when it is due,
+// open-loop as RunOpenLoop does; offsets are divided by speed, e.g. 2 issues
+// them twice as fast. options.qps, arrivals, duration and seed are ignored.
+// Returns the total result once every call has finished, and sets
+// (*by_label)[l] to the result of the calls labelled l.
+LoadResult RunSchedule(const LoadOptions& options,
+                       const std::vector<ScheduledCall>& calls, double speed,
+                       const ScheduledCallFactory& factory,
+                       std::vector<LoadResult>* by_label);
+
+// For generators of other kinds of load, e.g. stream_load.
+
+// How long a generator's thread waits for its calls once all are sent,
+// beyond their deadline, before giving up on them.
+constexpr std::chrono::seconds kDrainSlack(5);
+
+// The duration in whole microseconds, the unit of the latency histograms.
+int64_t Micros(std::chrono::steady_clock::duration duration);
+
+// Runs body(i) on each of n threads, and returns their results merged: body
+// returns a result type, such as LoadResult, with a Merge method.
+template <typename Body>
+auto RunThreads(int n, const Body& body) -> decltype(body(0)) {
+  std::vector<decltype(body(0))> results(n);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n; ++i) {
+    threads.emplace_back([&body, &results, i]() { results[i] = body(i); });
+  }
+  decltype(body(0)) total;
+  for (int i = 0; i < n; ++i) {
+    threads[i].join();
+    total.Merge(results[i]);
+  }
+  return total;
+}
+
+}  // namespace srecon
+
+#endif  // SRECON_LOAD_GENERATOR_H_
@@ -0,0 +1,290 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "greeter.grpc.pb.h"
+#include "load_worker.h"
+
+namespace srecon {
+
+namespace {
+
+// Beyond the load's duration and deadline, how long a coordinator waits
+// for workers to report.
+constexpr std::chrono::seconds kWorkerSlack(30);
+
+// How often a worker waiting to start checks whether it has been cancelled.
+constexpr std::chrono::milliseconds kStartPoll(100);
+
+void ToState(const LatencyHistogram& histogram, HistogramState* state) {
+  const std::vector<uint64_t>& counts = histogram.counts();
+  size_t size = counts.size();
+  while (size > 0 && counts[size - 1] == 0) {
+    --size;
+  }
+  state->mutable_counts()->Reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    state->add_counts(counts[i]);
+  }
+  state->set_min(histogram.min());
+  state->set_max(histogram.max());
+  state->set_sum(histogram.sum());
+}
+
+LatencyHistogram FromState(const HistogramState& state) {
+  return LatencyHistogram::FromState(
+      std::vector<uint64_t>(state.counts().begin(), state.counts().end()),
+      state.min(), state.max(), state.sum());
+}
+
+int64_t MillisSinceEpoch(std::chrono::system_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+void ToReport(const LoadResult& result, LoadReport* report) {
+  ToState(result.ok, report->mutable_ok());
+  ToState(result.failed, report->mutable_failed());
+  ToState(result.send_lag, report->mutable_send_lag());
+  for (const auto& error : result.errors) {
+    (*report->mutable_errors())[error.first] = error.second;
+  }
+  report->set_skipped(result.skipped);
+}
+
+void MergeReport(const LoadReport& report, LoadResult* result) {
+  LoadResult other;
+  other.ok = FromState(report.ok());
+  other.failed = FromState(report.failed());
+  other.send_lag = FromState(report.send_lag());
+  for (const auto& error : report.errors()) {
+    other.errors[error.first] = error.second;
+  }
+  other.skipped = report.skipped();
+  if (report.done()) {
+    other.elapsed = std::chrono::microseconds(report.elapsed_us());
+  }
+  result->Merge(other);
+}
+
+grpc::Status LoadWorkerImpl::RunLoad(grpc::ServerContext* context,
+                                     const LoadRequest* request,
+                                     grpc::ServerWriter<LoadReport>* writer) {
+  if (!(request->qps() > 0) || request->threads() <= 0 ||
+      request->duration_ms() <= 0) {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "qps, threads and duration must be positive");
+  }
+  if (std::find(targets_.begin(), targets_.end(),
+                request->greeter_server()) == targets_.end()) {
+    return grpc::Status(grpc::PERMISSION_DENIED,
+                        "this worker does not send load to " +
+                            request->greeter_server());
+  }
+  std::unique_ptr<Greeter::Stub> stub(Greeter::NewStub(grpc::CreateChannel(
+      request->greeter_server(), grpc::InsecureChannelCredentials())));
+
+  LoadOptions options;
+  options.qps = request->qps();
+  options.arrivals = request->constant_arrivals() ? LoadOptions::CONSTANT
+                                                  : LoadOptions::POISSON;
+  options.duration = std::chrono::milliseconds(request->duration_ms());
+  options.threads = request->threads();
+  if (request->max_in_flight() > 0) {
+    options.max_in_flight = request->max_in_flight();
+  }
+  if (request->deadline_ms() > 0) {
+    options.deadline_ms = request->deadline_ms();
+  }
+  options.seed = request->seed();
+  if (request->report_interval_ms() > 0) {
+    options.report_interval =
+        std::chrono::milliseconds(request->report_interval_ms());
+  }
+  std::mutex mu;
+  options.report = [&mu, writer](const LoadResult& interval) {
+    LoadReport report;
+    ToReport(interval, &report);
+    std::lock_guard<std::mutex> lock(mu);
+    writer->Write(report);
+  };
+  // The coordinator cancels the rest if one worker fails.
+  options.cancelled = [context]() { return context->IsCancelled(); };
+
+  const std::chrono::system_clock::time_point start(
+      std::chrono::milliseconds(request->start_time_ms()));
+  while (std::chrono::system_clock::now() < start) {
+    if (context->IsCancelled()) {
+      return grpc::Status::CANCELLED;
+    }
+    std::this_thread::sleep_until(
+        std::min(start, std::chrono::system_clock::now() + kStartPoll));
+  }
+  LOG(INFO) << "Sending " << options.qps << " qps to "
+            << request->greeter_server() << " for " << request->duration_ms()
+            << "ms, " << MillisSinceEpoch(std::chrono::system_clock::now()) -
+                             request->start_time_ms()
+            << "ms after the start time.";
+  const bool wait_for_ready = request->wait_for_ready();
+  LoadResult result =
+      RunOpenLoop(options, [&stub, request, wait_for_ready]() {
+        std::unique_ptr<LoadCall> call(
+            new UnaryLoadCall<Greeter::Stub, HelloRequest, HelloReply>(
+                stub.get(), &Greeter::Stub::AsyncSayHello,
+                request->request()));
+        call->context()->set_wait_for_ready(wait_for_ready);
+        return call;
+      });
+  if (context->IsCancelled()) {
+    LOG(INFO) << "Cancelled by the coordinator.";
+    return grpc::Status::CANCELLED;
+  }
+
+  LoadReport last;
+  last.set_done(true);
+  last.set_elapsed_us(std::chrono::duration_cast<std::chrono::microseconds>(
+                          result.elapsed)
+                          .count());
+  writer->Write(last);
+  return grpc::Status::OK;
+}
+
+grpc::Status RunDistributed(const std::vector<std::string>& workers,
+                            const LoadRequest& load, int start_delay_ms,
+                            std::ostream* progress, LoadResult* result) {
+  CHECK(!workers.empty());
+  const auto start = std::chrono::system_clock::now() +
+                     std::chrono::milliseconds(start_delay_ms);
+  LoadRequest share(load);
+  share.set_qps(load.qps() / workers.size());
+  share.set_start_time_ms(MillisSinceEpoch(start));
+  if (share.report_interval_ms() <= 0) {
+    share.set_report_interval_ms(1000);
+  }
+  const std::chrono::milliseconds report_interval(share.report_interval_ms());
+
+  std::mutex mu;
+  std::condition_variable finished;
+  LoadResult total;
+  LoadResult interval;
+  size_t running = workers.size();
+  std::vector<grpc::Status> statuses(workers.size());
+  std::vector<grpc::ClientContext> contexts(workers.size());
+  // The first worker to fail, whose failure cancels the rest.
+  int first_failure = -1;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      LoadRequest request(share);
+      // Each worker's threads draw arrivals from seeds of their own.
+      request.set_seed(load.seed() + i * 1000);
+      std::unique_ptr<LoadWorker::Stub> stub(LoadWorker::NewStub(
+          grpc::CreateChannel(workers[i],
+                              grpc::InsecureChannelCredentials())));
+      grpc::ClientContext& context = contexts[i];
+      context.set_deadline(start +
+                           std::chrono::milliseconds(load.duration_ms()) +
+                           std::chrono::milliseconds(load.deadline_ms()) +
+                           kWorkerSlack);
+      std::unique_ptr<grpc::ClientReader<LoadReport>> reader(
+          stub->RunLoad(&context, request));
+      LoadReport report;
+      while (reader->Read(&report)) {
+        std::lock_guard<std::mutex> lock(mu);
+        MergeReport(report, &total);
+        MergeReport(report, &interval);
+      }
+      grpc::Status status = reader->Finish();
+      std::lock_guard<std::mutex> lock(mu);
+      statuses[i] = status;
+      if (!status.ok() && first_failure < 0) {
+        first_failure = i;
+        // The combined results would be incomplete; stop waiting for them.
+        for (grpc::ClientContext& other : contexts) {
+          other.TryCancel();
+        }
+      }
+      --running;
+      finished.notify_all();
+    });
+  }
+
+  {
+    // Print halfway between the workers' reports, by when they have all
+    // arrived, so that each line covers one interval.
+    std::unique_lock<std::mutex> lock(mu);
+    auto next = start + report_interval + report_interval / 2;
+    for (int n = 1; running > 0; ++n, next += report_interval) {
+      if (finished.wait_until(lock, next, [&running]() {
+            return running == 0;
+          })) {
+        break;
+      }
+      if (progress != nullptr) {
+        *progress << "[" << n * report_interval.count() / 1000.0
+                  << "s] OK: ";
+        interval.ok.PrintSummary(progress);
+        *progress << " failed " << interval.failed.count() << std::endl;
+      }
+      interval = LoadResult();
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  *result = total;
+  if (first_failure >= 0) {
+    const grpc::Status& status = statuses[first_failure];
+    LOG(ERROR) << "Worker " << workers[first_failure]
+               << " failed, error code " << status.error_code() << ": "
+               << status.error_message();
+    return status;
+  }
+  return grpc::Status::OK;
+}
+
+}  // namespace srecon
@@ -0,0 +1,84 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_LOAD_WORKER_H_
+#define SRECON_LOAD_WORKER_H_
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <grpc++/grpc++.h>
+
+#include "load_generator.h"
+#include "loadgen.grpc.pb.h"
+
+namespace srecon {
+
+// Converts a LoadResult to the report which carries it to a coordinator.
+void ToReport(const LoadResult& result, LoadReport* report);
+
+// Adds the results carried by report to result, exactly.
+void MergeReport(const LoadReport& report, LoadResult* result);
+
+// Sends the load a coordinator asks for, from this process, until the
+// coordinator cancels it.
+class LoadWorkerImpl final : public LoadWorker::Service {
+ public:
+  // Only sends load to the greeters at the given addresses, so that anyone
+  // who can reach the worker cannot aim it elsewhere.
+  explicit LoadWorkerImpl(std::vector<std::string> targets)
+      : targets_(std::move(targets)) {}
+
+  // rpc RunLoad (LoadRequest) returns (stream LoadReport) {}
+  grpc::Status RunLoad(grpc::ServerContext* context,
+                       const LoadRequest* request,
+                       grpc::ServerWriter<LoadReport>* writer) override;
+
+ private:
+  const std::vector<std::string> targets_;
+};
+
+// Shares load out evenly among the workers at the given addresses, starting
+// them all together start_delay_ms from now, and sets result to the
+// combined results of all their calls. As each report interval's results
+// arrive, prints their combined percentiles to progress, if given. Fails if
+// any worker does.
+grpc::Status RunDistributed(const std::vector<std::string>& workers,
+                            const LoadRequest& load, int start_delay_ms,
+                            std::ostream* progress, LoadResult* result);
+
+}  // namespace srecon
+
+#endif  // SRECON_LOAD_WORKER_H_
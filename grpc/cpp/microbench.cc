@@ -0,0 +1,262 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Microbenchmarks of the translator's and greeter's hot paths, to judge
+// changes to their data structures by numbers. Run with e.g.
+//
+//   build/microbench --benchmark_filter=AllTranslations
+//
+// Catalogs are synthetic, from CatalogGenerator, of the given numbers of
+// messages and locales per message, unless named Builtin, which use kTransDB.
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpc++/grpc++.h>
+
+#include "catalog_generator.h"
+#include "greeter.pb.h"
+#include "greeting.h"
+#include "translation_behaviour.h"
+#include "translation_catalog.h"
+#include "translation_stats.h"
+#include "translator.pb.h"
+#include "virtual_clock.h"
+
+namespace srecon {
+
+namespace {
+
+const int kMaxThreads = 16;
+
+// Options for a catalog of the given size, with text of realistic lengths,
+// some of it outside ASCII.
+CatalogOptions Options(int messages, int locales) {
+  CatalogOptions options;
+  options.messages = messages;
+  options.locales = locales;
+  options.message_length.set_mean_ms(20);
+  options.message_length.set_stddev_ms(8);
+  options.translation_length.set_distribution(Jitter::LOG_NORMAL);
+  options.translation_length.set_mean_ms(40);
+  options.translation_length.set_stddev_ms(30);
+  options.non_ascii = 0.1;
+  return options;
+}
+
+// Returns a catalog of the given size, built once and shared by all the
+// benchmarks' threads.
+const TranslationCatalog& Catalog(int messages, int locales) {
+  static std::mutex mu;
+  static std::map<std::pair<int, int>, std::unique_ptr<TranslationCatalog>>
+      catalogs;
+  std::lock_guard<std::mutex> lock(mu);
+  std::unique_ptr<TranslationCatalog>& catalog =
+      catalogs[std::make_pair(messages, locales)];
+  if (!catalog) {
+    catalog.reset(new TranslationCatalog(
+        CatalogGenerator(Options(messages, locales)).Generate()));
+  }
+  return *catalog;
+}
+
+// Looks up each of the requests in turn, as Translate does.
+void LookUp(benchmark::State& state, const TranslationMap& db,
+            const std::vector<TranslationRequest>& requests) {
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    const TranslationRequest& request = requests[i++ % requests.size()];
+    auto message = db.find(request.message());
+    if (message != db.end()) {
+      auto translation = message->second.find(request.locale());
+      benchmark::DoNotOptimize(translation);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_TranslateLookup(benchmark::State& state) {
+  const TranslationCatalog& catalog = Catalog(state.range(0),
+                                              state.range(1));
+  CatalogGenerator generator(Options(state.range(0), state.range(1)));
+  std::vector<TranslationRequest> requests(1024);
+  for (size_t i = 0; i < requests.size(); ++i) {
+    // Spread over the catalog, one in eight for a missing locale.
+    requests[i].set_message(generator.Message(i * 7919 % state.range(0)));
+    requests[i].set_locale(SyntheticLocale(i * 31 % (state.range(1) + 1)));
+  }
+  LookUp(state, catalog.entries(), requests);
+}
+BENCHMARK(BM_TranslateLookup)
+    ->Args({10, 8})->Args({1000, 8})->Args({1000, 64})->Args({100000, 8})
+    ->ThreadRange(1, kMaxThreads);
+
+void BM_TranslateLookupBuiltin(benchmark::State& state) {
+  std::vector<TranslationRequest> requests;
+  for (const auto& message : kTransDB) {
+    for (const auto& translation : message.second) {
+      requests.emplace_back();
+      requests.back().set_message(message.first);
+      requests.back().set_locale(translation.first);
+    }
+  }
+  LookUp(state, kTransDB, requests);
+}
+BENCHMARK(BM_TranslateLookupBuiltin)->ThreadRange(1, kMaxThreads);
+
+// The filter loop of AllTranslations for all English rows, less the
+// injected behaviour and the writes.
+void BM_AllTranslationsFilter(benchmark::State& state) {
+  const TranslationCatalog& catalog = Catalog(state.range(0),
+                                              state.range(1));
+  AllTranslationsRequest request;
+  request.add_locales("en_");
+  int64_t rows = 0;
+  while (state.KeepRunning()) {
+    for (RowIterator row = catalog.Rows(); row.Valid(); row.Next()) {
+      ++rows;
+      if (MatchesLocales(request, row.locale())) {
+        AllTranslationsReply reply;
+        reply.set_message(row.message());
+        reply.set_locale(row.locale());
+        reply.set_translation(row.translation());
+        reply.set_continuation_token(
+            catalog.MakeToken(row.message(), row.locale()));
+        benchmark::DoNotOptimize(reply);
+      }
+    }
+  }
+  state.SetItemsProcessed(rows);
+}
+BENCHMARK(BM_AllTranslationsFilter)
+    ->Args({10, 8})->Args({1000, 8})->Args({1000, 64})->Args({10000, 8})
+    ->ThreadRange(1, kMaxThreads);
+
+// Behaviours shared by the threads of BM_BehaveUnary, and so contended
+// when there are several: the default, with nothing injected; a looped
+// script, whose calls share a cursor; and rate rules.
+ExpectedBehaviour& Behaviour(int kind) {
+  static ServerStats stats;
+  static ExpectedBehaviour* behaviours[3];
+  static std::once_flag once;
+  std::call_once(once, []() {
+    for (ExpectedBehaviour*& behaviour : behaviours) {
+      behaviour = new ExpectedBehaviour(&stats, "", std::chrono::hours(1));
+    }
+    BehaviourDefinition scripted;
+    scripted.add_unary()->set_repeat(100);
+    scripted.add_unary()->set_result(NOT_FOUND);
+    scripted.set_loop_unary(true);
+    behaviours[1]->Update("", scripted);
+    BehaviourDefinition rates;
+    RateRule* rule = rates.add_unary_rates();
+    rule->set_probability(0.01);
+    rule->set_result(NOT_FOUND);
+    behaviours[2]->Update("", rates);
+  });
+  return *behaviours[kind];
+}
+
+void BM_BehaveUnary(benchmark::State& state) {
+  ExpectedBehaviour& behaviour = Behaviour(state.range(0));
+  grpc::ServerContext context;
+  const std::string message("Hello");
+  const std::string locale("en_US");
+  while (state.KeepRunning()) {
+    VirtualCall clock(&context);
+    benchmark::DoNotOptimize(
+        behaviour.BehaveUnary(&context, &clock, message, locale));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BehaveUnary)
+    ->ArgName("kind")->DenseRange(0, 2)->ThreadRange(1, kMaxThreads);
+
+// Serializes the reply, with text of the benchmark's length.
+template <typename Reply>
+void Serialize(benchmark::State& state, const Reply& reply) {
+  std::string wire;
+  while (state.KeepRunning()) {
+    reply.SerializeToString(&wire);
+    benchmark::DoNotOptimize(wire);
+  }
+  state.SetBytesProcessed(state.iterations() * wire.size());
+}
+
+void BM_SerializeTranslationReply(benchmark::State& state) {
+  TranslationReply reply;
+  reply.set_translation(std::string(state.range(0), 'x'));
+  Serialize(state, reply);
+}
+BENCHMARK(BM_SerializeTranslationReply)
+    ->Range(8, 4096)->ThreadRange(1, kMaxThreads);
+
+void BM_SerializeHelloReply(benchmark::State& state) {
+  HelloReply reply;
+  reply.set_message(std::string(state.range(0), 'x'));
+  Serialize(state, reply);
+}
+BENCHMARK(BM_SerializeHelloReply)
+    ->Range(8, 4096)->ThreadRange(1, kMaxThreads);
+
+// The greeter's reply to a name of the given length.
+void BM_AssembleGreeting(benchmark::State& state) {
+  const std::string greeting("How do you do");
+  const std::string name(state.range(0), 'x');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(AssembleGreeting(greeting, name));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AssembleGreeting)->Range(4, 256)->ThreadRange(1, kMaxThreads);
+
+}  // namespace
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  // Logs to files, as the servers do, rather than to the terminal.
+  google::InitGoogleLogging(argv[0]);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
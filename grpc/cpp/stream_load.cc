@@ -0,0 +1,324 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glog/logging.h>
+#include <grpc++/alarm.h>
+#include <grpc++/grpc++.h>
+
+#include "stream_load.h"
+
+namespace srecon {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+class HelloStream;
+
+// An operation on a stream, as tagged on the completion queue. A stream
+// has at most one of each kind outstanding.
+struct Step {
+  enum Kind { START, WRITE, READ, FINISH, ALARM, NUM_KINDS };
+
+  HelloStream* stream;
+  Kind kind;
+};
+
+// One ManyHellos stream, writing requests as they fall due and reading
+// replies as they come, both at once.
+class HelloStream {
+ public:
+  HelloStream(Greeter::Stub* stub, const HelloRequest& request,
+              const StreamLoadOptions& options, Clock::time_point end,
+              std::mt19937* urng, grpc::CompletionQueue* cq,
+              StreamLoadResult* result)
+      : request_(request), options_(options), end_(end), urng_(urng),
+        cq_(cq), result_(result), opened_(Clock::now()), written_(0),
+        writing_(false), closing_(false), half_closed_(false),
+        broken_(false), replied_(false), finished_(false),
+        alarm_pending_(false) {
+    for (int kind = 0; kind < Step::NUM_KINDS; ++kind) {
+      steps_[kind] = Step{this, static_cast<Step::Kind>(kind)};
+    }
+    context_.set_deadline(std::chrono::system_clock::now() +
+                          (end - opened_) +
+                          std::chrono::milliseconds(options.deadline_ms));
+    next_due_ = opened_ + Gap();
+    stream_ = stub->AsyncManyHellos(&context_, cq, &steps_[Step::START]);
+  }
+
+  // Takes the next steps once one completes. Returns true, once only, when
+  // the stream has finished and has nothing outstanding.
+  bool Proceed(Step::Kind kind, bool ok) {
+    const Clock::time_point now = Clock::now();
+    switch (kind) {
+      case Step::START:
+        if (!ok) {
+          Finish();
+          break;
+        }
+        stream_->Read(&reply_, &steps_[Step::READ]);
+        Arm(std::min(next_due_, end_));
+        break;
+      case Step::ALARM:
+        alarm_pending_ = false;
+        if (broken_) {
+          break;
+        }
+        while (next_due_ <= now && next_due_ < end_) {
+          due_.push_back(next_due_);
+          next_due_ += Gap();
+        }
+        if (now >= end_) {
+          closing_ = true;
+        } else {
+          Arm(std::min(next_due_, end_));
+        }
+        WriteNext(now);
+        break;
+      case Step::WRITE:
+        writing_ = false;
+        if (!ok) {
+          // The stream has failed, which the reads will find.
+          broken_ = true;
+          break;
+        }
+        WriteNext(now);
+        break;
+      case Step::READ:
+        if (!ok) {
+          broken_ = true;
+          Finish();
+          break;
+        }
+        if (!replied_) {
+          replied_ = true;
+          result_->first_reply.Record(Micros(now - opened_));
+        }
+        if (written_ == 0) {
+          ++result_->unexpected;
+        } else {
+          result_->message.Record(Micros(now - due_.front()));
+          due_.pop_front();
+          --written_;
+        }
+        stream_->Read(&reply_, &steps_[Step::READ]);
+        break;
+      case Step::FINISH:
+        finished_ = true;
+        ++result_->streams[status_.error_code()];
+        result_->unanswered += written_;
+        if (half_closed_) {
+          result_->close.Record(Micros(now - half_closed_at_));
+        }
+        break;
+      case Step::NUM_KINDS:
+        LOG(FATAL) << "Not a step.";  // Crash ok
+    }
+    return finished_ && !writing_ && !alarm_pending_;
+  }
+
+  void Cancel() { context_.TryCancel(); }
+
+ private:
+  Clock::duration Gap() {
+    if (options_.arrivals == LoadOptions::CONSTANT) {
+      return std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1 / options_.messages_per_second));
+    }
+    std::exponential_distribution<double> gap(options_.messages_per_second);
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(gap(*urng_)));
+  }
+
+  void Arm(Clock::time_point when) {
+    alarm_pending_ = true;
+    alarm_.reset(new grpc::Alarm(
+        cq_, std::chrono::system_clock::now() + (when - Clock::now()),
+        &steps_[Step::ALARM]));
+  }
+
+  // Writes the next request due, or half-closes once none are left.
+  void WriteNext(Clock::time_point now) {
+    if (writing_ || broken_ || half_closed_) {
+      return;
+    }
+    if (written_ < due_.size()) {
+      ++written_;
+      ++result_->sent;
+      writing_ = true;
+      stream_->Write(request_, &steps_[Step::WRITE]);
+    } else if (closing_) {
+      half_closed_ = true;
+      half_closed_at_ = now;
+      writing_ = true;
+      stream_->WritesDone(&steps_[Step::WRITE]);
+    }
+  }
+
+  void Finish() {
+    stream_->Finish(&status_, &steps_[Step::FINISH]);
+  }
+
+  const HelloRequest& request_;
+  const StreamLoadOptions& options_;
+  const Clock::time_point end_;
+  std::mt19937* urng_;
+  grpc::CompletionQueue* cq_;
+  StreamLoadResult* result_;
+  const Clock::time_point opened_;
+
+  grpc::ClientContext context_;
+  std::unique_ptr<grpc::ClientAsyncReaderWriter<HelloRequest, HelloReply>>
+      stream_;
+  Step steps_[Step::NUM_KINDS];
+  std::unique_ptr<grpc::Alarm> alarm_;
+  HelloReply reply_;
+  grpc::Status status_;
+
+  // When each request not yet answered was due, oldest first; the first
+  // written_ of them have been written.
+  std::deque<Clock::time_point> due_;
+  size_t written_;
+  Clock::time_point next_due_;
+  Clock::time_point half_closed_at_;
+  bool writing_;
+  bool closing_;
+  bool half_closed_;
+  bool broken_;
+  bool replied_;
+  bool finished_;
+  bool alarm_pending_;
+};
+
+// Drives its share of the streams on a completion queue of its own.
+StreamLoadResult RunThread(Greeter::Stub* stub, const HelloRequest& request,
+                           const StreamLoadOptions& options, int streams,
+                           int thread) {
+  StreamLoadResult result;
+  std::mt19937 urng(options.seed + thread);
+  grpc::CompletionQueue cq;
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + options.duration;
+  std::vector<std::unique_ptr<HelloStream>> open;
+  for (int i = 0; i < streams; ++i) {
+    open.emplace_back(new HelloStream(stub, request, options, end, &urng,
+                                      &cq, &result));
+  }
+
+  const auto deadline = std::chrono::system_clock::now() + options.duration +
+                        std::chrono::milliseconds(options.deadline_ms) +
+                        kDrainSlack;
+  for (int active = streams; active > 0; ) {
+    void* tag;
+    bool ok;
+    const grpc::CompletionQueue::NextStatus next =
+        cq.AsyncNext(&tag, &ok, deadline);
+    if (next == grpc::CompletionQueue::TIMEOUT) {
+      LOG(ERROR) << active << " streams never finished.";
+      for (const std::unique_ptr<HelloStream>& stream : open) {
+        stream->Cancel();
+      }
+      break;
+    }
+    CHECK(next == grpc::CompletionQueue::GOT_EVENT);
+    const Step* step = static_cast<Step*>(tag);
+    if (step->stream->Proceed(step->kind, ok)) {
+      --active;
+    }
+  }
+  result.elapsed = Clock::now() - start;
+
+  cq.Shutdown();
+  void* tag;
+  bool ok;
+  while (cq.Next(&tag, &ok)) {
+  }
+  return result;
+}
+
+}  // namespace
+
+void StreamLoadResult::Merge(const StreamLoadResult& other) {
+  message.Merge(other.message);
+  first_reply.Merge(other.first_reply);
+  close.Merge(other.close);
+  for (const auto& count : other.streams) {
+    streams[count.first] += count.second;
+  }
+  sent += other.sent;
+  unanswered += other.unanswered;
+  unexpected += other.unexpected;
+  elapsed = std::max(elapsed, other.elapsed);
+}
+
+void StreamLoadResult::Print(std::ostream* out) const {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  *out << "Sent " << sent << " messages in " << seconds << "s ("
+       << (seconds > 0 ? sent / seconds : 0) << " per second), "
+       << unanswered << " unanswered, " << unexpected
+       << " unexpected replies.\n";
+  *out << "Streams finished:";
+  for (const auto& count : streams) {
+    *out << " code " << count.first << ": " << count.second;
+  }
+  *out << "\nMessage latency: ";
+  message.PrintSummary(out);
+  *out << "\nTime to first reply: ";
+  first_reply.PrintSummary(out);
+  *out << "\nHalf-close to status: ";
+  close.PrintSummary(out);
+  *out << "\n";
+}
+
+StreamLoadResult RunHelloStreams(Greeter::Stub* stub,
+                                 const HelloRequest& request,
+                                 const StreamLoadOptions& options) {
+  CHECK_GT(options.messages_per_second, 0);
+  const int threads =
+      std::max(1, std::min(options.threads, options.streams));
+  return RunThreads(threads, [stub, &request, &options, threads](int i) {
+    // Share the streams out as evenly as possible.
+    const int streams = options.streams / threads +
+                        (i < options.streams % threads ? 1 : 0);
+    return RunThread(stub, request, options, streams, i);
+  });
+}
+
+}  // namespace srecon
@@ -0,0 +1,96 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_STREAM_LOAD_H_
+#define SRECON_STREAM_LOAD_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+
+#include "greeter.grpc.pb.h"
+#include "latency_histogram.h"
+#include "load_generator.h"
+
+namespace srecon {
+
+struct StreamLoadOptions {
+  // The number of ManyHellos streams held open at once.
+  int streams = 1000;
+  // How often each stream sends a request.
+  double messages_per_second = 1;
+  LoadOptions::Arrivals arrivals = LoadOptions::POISSON;
+  // How long the streams send for, before half-closing.
+  std::chrono::milliseconds duration = std::chrono::seconds(10);
+  // Threads driving the streams, each with its own completion queue.
+  int threads = 2;
+  // Deadline for each stream, beyond duration.
+  int deadline_ms = 20 * 1000;
+  uint32_t seed = 1;
+};
+
+struct StreamLoadResult {
+  void Merge(const StreamLoadResult& other);
+  void Print(std::ostream* out) const;
+
+  // Latencies in microseconds. Each reply is taken to answer the oldest
+  // request outstanding on its stream, and is timed from when that request
+  // was due to be sent, so that backed-up writes count against it.
+  LatencyHistogram message;
+  // From opening each stream to its first reply.
+  LatencyHistogram first_reply;
+  // From half-closing each stream to its final status.
+  LatencyHistogram close;
+  // The number of streams that finished, by status code.
+  std::map<int, uint64_t> streams;
+  uint64_t sent = 0;
+  // Requests that had no reply when their stream finished.
+  uint64_t unanswered = 0;
+  // Replies with no request outstanding.
+  uint64_t unexpected = 0;
+  std::chrono::steady_clock::duration elapsed{};
+};
+
+// Holds options.streams ManyHellos streams open, each sending request at
+// options.messages_per_second for options.duration, open-loop, while
+// reading the replies; then half-closes them and waits for them to finish.
+// The request should select exactly one translation, as a full locale such
+// as en_US does, so that each request has one reply.
+StreamLoadResult RunHelloStreams(Greeter::Stub* stub,
+                                 const HelloRequest& request,
+                                 const StreamLoadOptions& options);
+
+}  // namespace srecon
+
+#endif  // SRECON_STREAM_LOAD_H_
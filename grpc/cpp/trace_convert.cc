@@ -0,0 +1,231 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Converts a latency trace between CSV and the binary form replayed by the
+// translation server (see latency_trace.h). Each CSV line is
+//
+//   offset_ms,latency_ms,status
+//
+// with the call's arrival time from the start of the trace, its latency,
+// and its canonical status code as a number or name, e.g. UNAVAILABLE.
+// Lines must be in order of offset; empty lines and '#' comments are
+// skipped. With --decode, converts a binary trace back to CSV.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "latency_trace.h"
+
+DEFINE_string(input, "-",
+              "The trace to read; - for standard input, except with "
+              "--decode.");
+DEFINE_string(output, "", "Where to write the binary trace.");
+DEFINE_bool(decode, false,
+            "Instead, print the binary trace --input as CSV.");
+
+namespace srecon {
+
+namespace {
+
+const char* const kStatusNames[] = {
+  "OK", "CANCELLED", "UNKNOWN", "INVALID_ARGUMENT", "DEADLINE_EXCEEDED",
+  "NOT_FOUND", "ALREADY_EXISTS", "PERMISSION_DENIED", "RESOURCE_EXHAUSTED",
+  "FAILED_PRECONDITION", "ABORTED", "OUT_OF_RANGE", "UNIMPLEMENTED",
+  "INTERNAL", "UNAVAILABLE", "DATA_LOSS", "UNAUTHENTICATED",
+};
+constexpr int kNumStatuses = sizeof(kStatusNames) / sizeof(kStatusNames[0]);
+
+// Parses a status code by number or name, returning false if it is neither.
+bool ParseStatus(const std::string& text, int32_t* status) {
+  for (int i = 0; i < kNumStatuses; ++i) {
+    if (text == kStatusNames[i]) {
+      *status = i;
+      return true;
+    }
+  }
+  char* end;
+  long code = std::strtol(text.c_str(), &end, 10);
+  if (text.empty() || *end != '\0' || code < 0 || code >= kNumStatuses) {
+    return false;
+  }
+  *status = code;
+  return true;
+}
+
+// Parses one CSV line into record, returning false if it is malformed.
+bool ParseRecord(const std::string& line, TraceRecord* record) {
+  std::istringstream fields(line);
+  std::string offset_ms, latency_ms, status;
+  if (!std::getline(fields, offset_ms, ',') ||
+      !std::getline(fields, latency_ms, ',') ||
+      !std::getline(fields, status)) {
+    return false;
+  }
+  char* end;
+  const double offset = std::strtod(offset_ms.c_str(), &end);
+  if (*end != '\0' || !(offset >= 0)) return false;
+  const double latency = std::strtod(latency_ms.c_str(), &end);
+  if (*end != '\0' || !(latency >= 0) || latency * 1000 > UINT32_MAX) {
+    return false;
+  }
+  record->offset_us = std::llround(offset * 1000);
+  record->latency_us = std::llround(latency * 1000);
+  return ParseStatus(status, &record->status);
+}
+
+// Closes and removes the partial output, returning the exit status.
+int Abandon(std::FILE* out, const std::string& output) {
+  std::fclose(out);
+  std::remove(output.c_str());
+  return 1;
+}
+
+int Encode(std::istream& in, const std::string& output) {
+  std::FILE* out = std::fopen(output.c_str(), "wb");
+  if (out == nullptr) {
+    LOG(ERROR) << "Cannot open " << output;
+    return 1;
+  }
+  TraceHeader header;
+  std::copy(kTraceMagic, kTraceMagic + sizeof(kTraceMagic), header.magic);
+  header.version = kTraceVersion;
+  header.record_size = sizeof(TraceRecord);
+  if (std::fwrite(&header, sizeof(header), 1, out) != 1) {
+    LOG(ERROR) << "Cannot write " << output;
+    return Abandon(out, output);
+  }
+
+  // Records are streamed through, so a trace of any length converts in
+  // constant memory.
+  std::string line;
+  uint64_t records = 0;
+  uint64_t last_offset_us = 0;
+  for (int line_number = 1; std::getline(in, line); ++line_number) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    TraceRecord record;
+    if (!ParseRecord(line, &record)) {
+      LOG(ERROR) << "Line " << line_number << " is malformed: " << line;
+      return Abandon(out, output);
+    }
+    if (record.offset_us < last_offset_us) {
+      LOG(ERROR) << "Line " << line_number << " is out of order: " << line;
+      return Abandon(out, output);
+    }
+    last_offset_us = record.offset_us;
+    if (std::fwrite(&record, sizeof(record), 1, out) != 1) {
+      LOG(ERROR) << "Cannot write " << output;
+      return Abandon(out, output);
+    }
+    ++records;
+  }
+  if (std::fclose(out) != 0) {
+    LOG(ERROR) << "Cannot write " << output;
+    std::remove(output.c_str());
+    return 1;
+  }
+  LOG(INFO) << "Wrote " << records << " records, spanning "
+            << last_offset_us / 1000 << "ms, to " << output << ".";
+  return 0;
+}
+
+// Writes micros in ms, exactly, as ParseRecord reads them back.
+void PrintMillis(uint64_t micros) {
+  std::cout << micros / 1000 << "." << std::setw(3) << std::setfill('0')
+            << micros % 1000;
+}
+
+int Decode(const std::string& input) {
+  std::string error;
+  std::unique_ptr<const LatencyTrace> trace = LatencyTrace::Open(input, &error);
+  if (!trace) {
+    LOG(ERROR) << error;
+    return 1;
+  }
+  for (size_t i = 0; i < trace->size(); ++i) {
+    const TraceRecord& record = (*trace)[i];
+    PrintMillis(record.offset_us);
+    std::cout << ",";
+    PrintMillis(record.latency_us);
+    std::cout << ",";
+    if (record.status >= 0 && record.status < kNumStatuses) {
+      std::cout << kStatusNames[record.status] << "\n";
+    } else {
+      std::cout << record.status << "\n";
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_decode) {
+    // Traces are mapped into memory, so must be files.
+    if (FLAGS_input == "-") {
+      LOG(ERROR) << "--decode needs a trace file as --input, not standard "
+                 << "input.";
+      return 1;
+    }
+    return srecon::Decode(FLAGS_input);
+  }
+  if (FLAGS_output.empty()) {
+    LOG(ERROR) << "--output is required.";
+    return 1;
+  }
+  if (FLAGS_input == "-") {
+    return srecon::Encode(std::cin, FLAGS_output);
+  }
+  std::ifstream in(FLAGS_input);
+  if (!in) {
+    LOG(ERROR) << "Cannot open " << FLAGS_input;
+    return 1;
+  }
+  return srecon::Encode(in, FLAGS_output);
+}
@@ -31,7 +31,13 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
 
 #include <glog/logging.h>
 
@@ -39,85 +45,789 @@
 
 namespace srecon{
 
-ExpectedBehaviour::ExpectedBehaviour()
-    : urng_(std::random_device()()), next_unary_(0), next_stream_(0) {
+namespace {
+
+// Allowance for rounding in rate rule probabilities that should sum to 1.
+constexpr double kProbabilityEpsilon = 1e-9;
+
+// The method names a Match may give.
+constexpr char kUnaryMethod[] = "Translate";
+constexpr char kStreamMethod[] = "AllTranslations";
+
+// Which of method (bit 0), message (bit 1) and locale (bit 2) a Match sets,
+// from the most specific to the least. The untargeted behaviour, pattern 0,
+// comes last, and is not in the dispatch tables.
+constexpr unsigned kPatterns[] = {7, 6, 5, 3, 4, 2, 1};
+
+// The dispatch table key of the calls with the given fields, of which those
+// not in pattern are left out. The method is a string_ref so that calls,
+// which name theirs by a constant, need not copy it first.
+std::string DispatchKey(unsigned pattern, grpc::string_ref method,
+                        const std::string& message,
+                        const std::string& locale) {
+  std::string key;
+  key.reserve(method.size() + message.size() + locale.size() + 3);
+  key.push_back('0' + pattern);
+  if (pattern & 1) key.append(method.data(), method.size());
+  key.push_back('\0');
+  if (pattern & 2) key.append(message);
+  key.push_back('\0');
+  if (pattern & 4) key.append(locale);
+  return key;
+}
+
+unsigned Pattern(const Match& match) {
+  return (match.method().empty() ? 0 : 1) |
+         (match.message().empty() ? 0 : 2) |
+         (match.locale().empty() ? 0 : 4);
+}
+
+// The metadata a Match requires, in a canonical order.
+std::vector<std::pair<std::string, std::string>> SortedMetadata(
+    const Match& match) {
+  std::vector<std::pair<std::string, std::string>> metadata(
+      match.metadata().begin(), match.metadata().end());
+  std::sort(metadata.begin(), metadata.end());
+  return metadata;
+}
+
+// Identifies the Match, so that behaviours with equal ones share a script;
+// empty for the untargeted behaviour.
+std::string TargetKey(const Match& match) {
+  if (Pattern(match) == 0 && match.peer().empty() &&
+      match.metadata().empty()) {
+    return "";
+  }
+  std::string key = DispatchKey(Pattern(match), match.method(),
+                                match.message(), match.locale());
+  key.push_back('\0');
+  key.append(match.peer());
+  for (const auto& entry : SortedMetadata(match)) {
+    key.push_back('\0');
+    key.append(entry.first);
+    key.push_back('=');
+    key.append(entry.second);
+  }
+  return key;
+}
+
+// Whether path is relative, and has no ".." component to climb out of the
+// directory it is relative to.
+bool IsRelativeBelow(const std::string& path) {
+  if (path.empty() || path[0] == '/') {
+    return false;
+  }
+  for (size_t start = 0; start <= path.size();) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    if (path.compare(start, end - start, "..") == 0) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+std::atomic<uint32_t> behaviour_seed(0);
+// The number of draws made with behaviour_seed so far.
+std::atomic<uint64_t> seeded_draws(0);
+
+// Returns a uniform variate in [0, 1) for a random choice of behaviour.
+// Seeded, the nth draw is SplitMix64's hash of the seed and n, so a run
+// makes the same draws in the same order however its calls are spread over
+// threads; they differ only if the calls arrive in a different order.
+// Unseeded, each thread draws from its own generator, so calls need not
+// share a counter.
+double Uniform() {
+  const uint32_t seed = behaviour_seed;
+  if (seed == 0) {
+    thread_local std::mt19937 urng(std::random_device{}());
+    return std::uniform_real_distribution<double>()(urng);
+  }
+  uint64_t z = (uint64_t{seed} << 32) +
+               (seeded_draws.fetch_add(1) + 1) * 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  z ^= z >> 31;
+  // The top 53 bits, as many as a double holds exactly.
+  return std::ldexp(static_cast<double>(z >> 11), -53);
+}
+
+}  // namespace
+
+void SeedBehaviour(uint32_t seed) {
+  behaviour_seed = seed;
+  seeded_draws = 0;
+}
+
+std::string SessionOf(const grpc::ServerContext& context) {
+  const auto& metadata = context.client_metadata();
+  auto session = metadata.find(kSessionMetadataKey);
+  if (session == metadata.end()) {
+    return "";
+  }
+  return std::string(session->second.data(), session->second.size());
+}
+
+grpc::Status CheckCallerWaiting(grpc::ServerContext* context,
+                                ServerStats* stats) {
+  if (context->IsCancelled()) {
+    stats->Increment(ServerStats::kCallsCancelled);
+    return grpc::Status::CANCELLED;
+  }
+  if (std::chrono::system_clock::now() >= context->deadline()) {
+    stats->Increment(ServerStats::kCallsPastDeadline);
+    return grpc::Status(grpc::DEADLINE_EXCEEDED, "Deadline exceeded");
+  }
+  return grpc::Status::OK;
+}
+
+ExpectedBehaviour::ExpectedBehaviour(ServerStats* stats,
+                                     const std::string& trace_dir,
+                                     std::chrono::seconds session_ttl)
+    : stats_(stats), trace_dir_(trace_dir), session_ttl_(session_ttl),
+      sessions_(new Sessions), epoch_(0) {
+  readers_[0] = readers_[1] = 0;
   // By default, everything works with no extra delay.
-  Behaviour* b = definition_.add_unary();
-  b->mutable_jitter()->set_mean_ms(0);
-  b->set_result(OK);
+  std::shared_ptr<Plan> plan = std::make_shared<Plan>();
+  plan->unary.loop = plan->stream.loop = false;
+  plan->unary.cursor = plan->stream.cursor = 0;
+  plan->unary.trace_cursor = plan->stream.trace_cursor = 0;
+  plan->unary_targets.patterns = plan->stream_targets.patterns = 0;
+  Versions* global = new Versions;
+  global->active = plan;
+  global_ = global;
+}
 
-  b = definition_.add_stream();
-  b->mutable_jitter()->set_mean_ms(0);
-  b->set_result(OK);
+ExpectedBehaviour::~ExpectedBehaviour() {
+  delete global_.load();
+  delete sessions_.load();
+}
+
+unsigned ExpectedBehaviour::BeginRead() const {
+  for (;;) {
+    const unsigned epoch = epoch_.load();
+    readers_[epoch & 1].fetch_add(1);
+    // If an update started a new epoch meanwhile, it may not wait for this
+    // reader, so register in the new one.
+    if (epoch_.load() == epoch) {
+      return epoch;
+    }
+    readers_[epoch & 1].fetch_sub(1);
+  }
+}
+
+void ExpectedBehaviour::EndRead(unsigned epoch) const {
+  readers_[epoch & 1].fetch_sub(1);
+}
+
+void ExpectedBehaviour::WaitForReaders() {
+  // Readers of the epoch before last were waited for by the last update, so
+  // the readers of the last epoch are all that can still hold the old
+  // pointers. They only copy out a plan, so this is a short wait.
+  const unsigned epoch = epoch_.fetch_add(1);
+  while (readers_[epoch & 1].load() != 0) {
+    std::this_thread::yield();
+  }
 }
 
 // Update the expected behaviour from a new requested definition.
-void ExpectedBehaviour::Update(const BehaviourDefinition& definition) {
-  LOG(INFO) << "Received new BehaviourDefinition, with "
-            << definition.unary_size() << " unary results, and "
-            << definition.stream_size() << " stream results.";
-  std::lock_guard<std::mutex> lock(mu_);
-  definition_ = definition;
-  next_unary_ = next_stream_ = 0;
-  if (definition.unary_size() > 0 &&
-      definition.unary(0).jitter().mean_ms() > 0) {
-    jitter_.reset(new std::normal_distribution<>(
-        definition.unary(0).jitter().mean_ms(),
-        definition.unary(0).jitter().stddev_ms()));
-  } else if (definition.stream_size() > 0 &&
-             definition.stream(0).jitter().mean_ms() > 0) {
-    jitter_.reset(new std::normal_distribution<>(
-        definition.stream(0).jitter().mean_ms(),
-        definition.stream(0).jitter().stddev_ms()));
+grpc::Status ExpectedBehaviour::Update(const std::string& session,
+                                       const BehaviourDefinition& definition) {
+  LOG(INFO) << "Received new BehaviourDefinition for session \"" << session
+            << "\", with "
+            << definition.unary_size() << " unary results, "
+            << definition.unary_rates_size() << " unary rate rules, "
+            << definition.stream_size() << " stream results, "
+            << definition.stream_rates_size() << " stream rate rules, and "
+            << definition.phases_size() << " phases.";
+  // Compiling the delay distributions takes a while, but the calls carry on
+  // with the old plan until the new one is published.
+  std::shared_ptr<Plan> plan = std::make_shared<Plan>();
+  grpc::Status status = CompilePlan(definition, plan.get());
+  if (!status.ok()) {
+    LOG(WARNING) << "Rejected BehaviourDefinition: "
+                 << status.error_message();
+    return status;
+  }
+  for (const auto& delay : plan->delays) {
+    if (delay.second) {
+      LOG(INFO) << "Delay jitter: " << delay.second->description() << ".";
+    }
+  }
+  // The phases are timed from when the plan takes effect.
+  const auto now = std::chrono::system_clock::now();
+  plan->activation = now;
+  if (definition.activation_time_ms() > 0) {
+    plan->activation = std::chrono::system_clock::time_point(
+        std::chrono::milliseconds(definition.activation_time_ms()));
+  }
+  const auto wait = std::max(plan->activation - now,
+                             std::chrono::system_clock::duration::zero());
+  plan->start = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait);
+  if (wait > std::chrono::system_clock::duration::zero()) {
+    LOG(INFO) << "Activating in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     wait).count()
+              << "ms.";
+  }
+
+  // Keeps what is in force now, replacing any plan still pending.
+  auto install = [&plan, now](const Versions& old) {
+    Versions versions;
+    versions.active = old.Current(now);
+    if (plan->activation > now) {
+      versions.pending = plan;
+    } else {
+      versions.active = plan;
+    }
+    return versions;
+  };
+  std::lock_guard<std::mutex> lock(update_mu_);
+  if (session.empty()) {
+    const Versions* old = global_.exchange(new Versions(install(*global_)));
+    WaitForReaders();
+    delete old;
+    return grpc::Status::OK;
+  }
+  // Copies only the sessions which have not expired.
+  std::unique_ptr<Sessions> sessions(new Sessions);
+  for (const auto& versions : *sessions_) {
+    if (versions.second.expiry > now) {
+      sessions->insert(versions);
+    }
+  }
+  const size_t expired = sessions_.load()->size() - sessions->size();
+  if (expired > 0) {
+    LOG(INFO) << "Dropped " << expired << " expired sessions.";
+  }
+  if (definition.ByteSizeLong() == 0) {
+    sessions->erase(session);
   } else {
-    jitter_.release();
+    auto old = sessions->find(session);
+    Versions versions =
+        install(old == sessions->end() ? Versions() : old->second);
+    versions.expiry = std::max(plan->activation, now) + session_ttl_;
+    (*sessions)[session] = versions;
+  }
+  LOG(INFO) << sessions->size() << " sessions defined.";
+  const Sessions* old = sessions_.exchange(sessions.release());
+  WaitForReaders();
+  delete old;
+  return grpc::Status::OK;
+}
+
+std::shared_ptr<ExpectedBehaviour::Plan> ExpectedBehaviour::Versions::Current(
+    std::chrono::system_clock::time_point now) const {
+  if (pending && pending->activation <= now) {
+    return pending;
   }
+  return active;
 }
 
-grpc::Status ExpectedBehaviour::BehaveUnary() {
-  if (definition_.unary_size() > next_unary_) {
-    return Behave(definition_.unary(next_unary_++));
+std::shared_ptr<ExpectedBehaviour::Plan> ExpectedBehaviour::PlanFor(
+    const grpc::ServerContext& context) const {
+  const auto now = std::chrono::system_clock::now();
+  const std::string session = SessionOf(context);
+  const unsigned epoch = BeginRead();
+  const Sessions* sessions = sessions_.load();
+  std::shared_ptr<Plan> plan;
+  if (!sessions->empty()) {
+    auto versions = sessions->find(session);
+    // Expired sessions linger until the next update, but no longer apply.
+    if (versions != sessions->end() && versions->second.expiry > now) {
+      plan = versions->second.Current(now);
+    }
+  }
+  if (!plan) {
+    plan = global_.load()->Current(now);
+  }
+  EndRead(epoch);
+  return plan;
+}
+
+grpc::Status ExpectedBehaviour::CompilePlan(
+    const BehaviourDefinition& definition, Plan* plan) const {
+  grpc::Status status = CompileTargets(
+      definition.unary(), definition.unary_rates(), definition.loop_unary(),
+      plan, &plan->unary, &plan->unary_targets);
+  if (!status.ok()) return status;
+  status = CompileTargets(
+      definition.stream(), definition.stream_rates(),
+      definition.loop_stream(), plan, &plan->stream, &plan->stream_targets);
+  if (!status.ok()) return status;
+  status = CompileTrace(definition.unary_trace(), &plan->unary);
+  if (!status.ok()) return status;
+  status = CompileTrace(definition.stream_trace(), &plan->stream);
+  if (!status.ok()) return status;
+
+  plan->phases.resize(definition.phases_size());
+  for (int i = 0; i < definition.phases_size(); ++i) {
+    const ScenarioPhase& phase = definition.phases(i);
+    const int64_t previous_start =
+        i > 0 ? definition.phases(i - 1).start_offset_ms() : 0;
+    if (phase.start_offset_ms() < previous_start) {
+      return grpc::Status(grpc::INVALID_ARGUMENT,
+                          "phases must start in order, from offset 0 on");
+    }
+    Phase* compiled = &plan->phases[i];
+    compiled->start_offset = std::chrono::milliseconds(phase.start_offset_ms());
+    compiled->linear = phase.interpolation() == ScenarioPhase::LINEAR;
+    std::vector<const RateRule*> unary_rates;
+    std::vector<const RateRule*> stream_rates;
+    for (const RateRule& rule : phase.unary_rates()) {
+      unary_rates.push_back(&rule);
+    }
+    for (const RateRule& rule : phase.stream_rates()) {
+      stream_rates.push_back(&rule);
+    }
+    for (const RateRule* rule : unary_rates) {
+      if (!TargetKey(rule->match()).empty()) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "phase rate rules cannot be targeted");
+      }
+    }
+    for (const RateRule* rule : stream_rates) {
+      if (!TargetKey(rule->match()).empty()) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "phase rate rules cannot be targeted");
+      }
+    }
+    status = CompileRates(unary_rates, plan, &compiled->unary);
+    if (!status.ok()) return status;
+    status = CompileRates(stream_rates, plan, &compiled->stream);
+    if (!status.ok()) return status;
+    if (compiled->linear && i + 1 < definition.phases_size() &&
+        (phase.unary_rates_size() !=
+             definition.phases(i + 1).unary_rates_size() ||
+         phase.stream_rates_size() !=
+             definition.phases(i + 1).stream_rates_size())) {
+      return grpc::Status(
+          grpc::INVALID_ARGUMENT,
+          "a LINEAR phase needs as many rules as the phase after it");
+    }
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status ExpectedBehaviour::CompileTargets(
+    const google::protobuf::RepeatedPtrField<Behaviour>& behaviours,
+    const google::protobuf::RepeatedPtrField<RateRule>& rules, bool loop,
+    Plan* owner, CallPlan* calls, Dispatch* targets) {
+  // Group the behaviours and rules by target, keeping their order.
+  struct Group {
+    const Match* match;
+    std::vector<const Behaviour*> behaviours;
+    std::vector<const RateRule*> rules;
+  };
+  std::map<std::string, Group> groups;
+  for (const Behaviour& behaviour : behaviours) {
+    Group& group = groups[TargetKey(behaviour.match())];
+    group.match = &behaviour.match();
+    group.behaviours.push_back(&behaviour);
+  }
+  for (const RateRule& rule : rules) {
+    Group& group = groups[TargetKey(rule.match())];
+    group.match = &rule.match();
+    group.rules.push_back(&rule);
+  }
+
+  const Group untargeted = groups[""];
+  grpc::Status status = CompileCalls(untargeted.behaviours, untargeted.rules,
+                                     loop, owner, calls);
+  if (!status.ok()) return status;
+  groups.erase("");
+
+  targets->patterns = 0;
+  for (const auto& entry : groups) {
+    const Match& match = *entry.second.match;
+    std::unique_ptr<Target> target(new Target);
+    target->peer = match.peer();
+    target->metadata = SortedMetadata(match);
+    status = CompileCalls(entry.second.behaviours, entry.second.rules, loop,
+                          owner, &target->calls);
+    if (!status.ok()) return status;
+    const unsigned pattern = Pattern(match);
+    targets->patterns |= 1u << pattern;
+    targets->buckets[DispatchKey(pattern, match.method(), match.message(),
+                                 match.locale())]
+        .push_back(std::move(target));
+  }
+  for (auto& bucket : targets->buckets) {
+    std::stable_sort(
+        bucket.second.begin(), bucket.second.end(),
+        [](const std::unique_ptr<Target>& a, const std::unique_ptr<Target>& b) {
+          return (a->peer.empty() ? 0 : 1) + a->metadata.size() >
+                 (b->peer.empty() ? 0 : 1) + b->metadata.size();
+        });
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status ExpectedBehaviour::CompileTrace(const TraceReplay& replay,
+                                             CallPlan* calls) const {
+  const std::string& path = replay.path();
+  if (path.empty()) {
+    return grpc::Status::OK;
+  }
+  // Anyone who can reach the control API may name a trace, so only those
+  // the operator put in trace_dir_ can be opened.
+  if (trace_dir_.empty()) {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "this translator replays no traces");
+  }
+  if (!IsRelativeBelow(path)) {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "trace paths must be within the trace directory");
+  }
+  // Only maps the file, so even a large trace opens at once.
+  std::string error;
+  calls->trace = LatencyTrace::Open(trace_dir_ + "/" + path, &error);
+  if (!calls->trace) {
+    LOG(WARNING) << "Cannot replay trace: " << error;
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "cannot replay trace " + path);
+  }
+  LOG(INFO) << "Replaying " << calls->trace->size() << " calls from trace "
+            << replay.path() << ".";
+  calls->trace_keying = replay.keying();
+  calls->trace_loop = replay.loop();
+  calls->trace_speed = replay.speed() > 0 ? replay.speed() : 1;
+  return grpc::Status::OK;
+}
+
+grpc::Status ExpectedBehaviour::CompileCalls(
+    const std::vector<const Behaviour*>& behaviours,
+    const std::vector<const RateRule*>& rules, bool loop,
+    Plan* owner, CallPlan* calls) {
+  calls->script.reserve(behaviours.size());
+  for (const Behaviour* behaviour : behaviours) {
+    calls->script.push_back(CallPlan::Run{
+        Outcome{behaviour->result(), CompileDelay(behaviour->jitter(), owner),
+                nullptr, 0, 0},
+        std::max<uint32_t>(behaviour->repeat(), 1)});
+  }
+  calls->loop = loop;
+  calls->cursor = 0;
+  calls->trace_cursor = 0;
+  return CompileRates(rules, owner, &calls->rates);
+}
+
+grpc::Status ExpectedBehaviour::CompileRates(
+    const std::vector<const RateRule*>& rules, Plan* owner, Rates* rates) {
+  // Rules of probability 0 are kept, so that they still line up with those
+  // of the next phase when interpolating.
+  double cumulative = 0;
+  for (const RateRule* rule : rules) {
+    // Written to reject NaN as well.
+    if (!(rule->probability() >= 0 && rule->probability() <= 1)) {
+      return grpc::Status(grpc::INVALID_ARGUMENT,
+                          "rate rule probability out of range");
+    }
+    cumulative += rule->probability();
+    rates->thresholds.push_back(cumulative);
+    rates->rules.push_back(Outcome{
+        rule->result(), CompileDelay(rule->jitter(), owner), nullptr, 0, 0});
+  }
+  if (cumulative > 1 + kProbabilityEpsilon) {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "rate rule probabilities sum to more than 1");
+  }
+  return grpc::Status::OK;
+}
+
+const LatencyDistribution* ExpectedBehaviour::CompileDelay(
+    const Jitter& jitter, Plan* owner) {
+  std::string key = jitter.SerializeAsString();
+  auto compiled = owner->delays.find(key);
+  if (compiled == owner->delays.end()) {
+    compiled = owner->delays.emplace(
+        key, DelayPtr(LatencyDistribution::Create(jitter))).first;
+  }
+  return compiled->second.get();
+}
+
+ExpectedBehaviour::Outcome ExpectedBehaviour::Choose(
+    Plan* plan, CallPlan* calls, Dispatch* targets, Rates Phase::*phase_rates,
+    const CallInfo& call) {
+  Outcome outcome;
+  // The caller's address, fetched by the first target that matches on it.
+  std::string peer;
+
+  // Use the most specific target with anything left, looking up only the
+  // patterns some target uses.
+  if (targets->patterns != 0) {
+    for (unsigned pattern : kPatterns) {
+      if ((targets->patterns & (1u << pattern)) == 0) {
+        continue;
+      }
+      auto bucket = targets->buckets.find(
+          DispatchKey(pattern, call.method, call.message, call.locale));
+      if (bucket == targets->buckets.end()) {
+        continue;
+      }
+      for (const std::unique_ptr<Target>& target : bucket->second) {
+        if (!Matches(*target, call, &peer)) {
+          continue;
+        }
+        if (ChooseScripted(&target->calls, &outcome)) {
+          return outcome;
+        }
+        if (!target->calls.rates.rules.empty()) {
+          return ChooseRate(target->calls.rates, nullptr, 0,
+                            Uniform());
+        }
+      }
+    }
+  }
+
+  if (ChooseScripted(calls, &outcome) ||
+      ChooseTraced(*plan, calls, &outcome)) {
+    return outcome;
+  }
+
+  // Find the current phase's rules, and when interpolating, the next's.
+  const Rates* rates = &calls->rates;
+  const Rates* next_rates = nullptr;
+  double weight = 0;
+  if (!plan->phases.empty()) {
+    const auto elapsed = std::chrono::steady_clock::now() - plan->start;
+    const auto next_phase = std::upper_bound(
+        plan->phases.begin(), plan->phases.end(), elapsed,
+        [](std::chrono::steady_clock::duration elapsed, const Phase& phase) {
+          return elapsed < phase.start_offset;
+        });
+    if (next_phase != plan->phases.begin()) {
+      const Phase& phase = *(next_phase - 1);
+      rates = &(phase.*phase_rates);
+      if (phase.linear && next_phase != plan->phases.end()) {
+        next_rates = &((*next_phase).*phase_rates);
+        weight = std::chrono::duration<double>(
+                     elapsed - phase.start_offset).count() /
+                 std::chrono::duration<double>(
+                     next_phase->start_offset - phase.start_offset).count();
+      }
+    }
+  }
+  if (rates->rules.empty()) {
+    return Outcome{OK, nullptr, nullptr, 0, 0};
+  }
+  return ChooseRate(*rates, next_rates, weight, Uniform());
+}
+
+bool ExpectedBehaviour::ChooseScripted(CallPlan* calls, Outcome* outcome) {
+  // Advance the cursor by one call, moving on to the next run at the end of
+  // each. Once the script has run out, the cursor stays put, so calls stop
+  // contending for its cache line.
+  const uint64_t runs = calls->script.size();
+  uint64_t cursor = calls->cursor.load(std::memory_order_relaxed);
+  while (cursor >> 32 < runs) {
+    const uint64_t run = cursor >> 32;
+    uint64_t next = cursor + 1;
+    if ((next & 0xffffffff) == calls->script[run].length) {
+      next = (run + 1 == runs && calls->loop ? 0 : run + 1) << 32;
+    }
+    if (calls->cursor.compare_exchange_weak(cursor, next,
+                                            std::memory_order_relaxed)) {
+      *outcome = calls->script[run].outcome;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ExpectedBehaviour::ChooseTraced(const Plan& plan, CallPlan* calls,
+                                     Outcome* outcome) {
+  const LatencyTrace* trace = calls->trace.get();
+  if (trace == nullptr || trace->size() == 0) {
+    return false;
+  }
+  size_t record;
+  if (calls->trace_keying == TraceReplay::ARRIVAL_ORDER) {
+    // As for the script, stop writing the cursor once the trace is spent.
+    if (!calls->trace_loop &&
+        calls->trace_cursor.load(std::memory_order_relaxed) >=
+            trace->size()) {
+      return false;
+    }
+    uint64_t call = calls->trace_cursor.fetch_add(1, std::memory_order_relaxed);
+    if (call >= trace->size()) {
+      if (!calls->trace_loop) {
+        return false;
+      }
+      call %= trace->size();
+    }
+    record = call;
   } else {
-    return Behave(default_);
+    uint64_t offset_us = static_cast<uint64_t>(
+        calls->trace_speed *
+        std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - plan.start).count());
+    const uint64_t length_us = (*trace)[trace->size() - 1].offset_us + 1;
+    if (offset_us >= length_us) {
+      if (!calls->trace_loop) {
+        return false;
+      }
+      offset_us %= length_us;
+    }
+    record = trace->Find(offset_us);
+    if (record == trace->size()) {
+      return false;
+    }
+  }
+  const TraceRecord& recorded = (*trace)[record];
+  int status = recorded.status;
+  if (status < grpc::OK || status > grpc::UNAUTHENTICATED) {
+    status = grpc::UNKNOWN;
   }
+  *outcome = Outcome{static_cast<ResultType>(status), nullptr, nullptr, 0,
+                     recorded.latency_us / 1000.0};
+  return true;
 }
 
-grpc::Status ExpectedBehaviour::BehaveStream() {
-  if (definition_.stream_size() > next_stream_) {
-    return Behave(definition_.stream(next_stream_++));
+ExpectedBehaviour::Outcome ExpectedBehaviour::ChooseRate(
+    const Rates& rates, const Rates* next_rates, double weight, double u) {
+  if (next_rates == nullptr) {
+    const auto rule = std::upper_bound(rates.thresholds.begin(),
+                                       rates.thresholds.end(), u);
+    if (rule != rates.thresholds.end()) {
+      return rates.rules[rule - rates.thresholds.begin()];
+    }
   } else {
-    return Behave(default_);
-  }
-}
-
-grpc::Status ExpectedBehaviour::Behave(const Behaviour& behaviour) {
-  long long sleep_time = 0;
-  grpc::Status result;
-  {
-    std::lock_guard<std::mutex> lock(mu_);
-    if (behaviour.jitter().mean_ms() > 0) {
-      if (!jitter_ ||
-          jitter_->mean() != behaviour.jitter().mean_ms()) {
-        jitter_.reset(new std::normal_distribution<>(
-            behaviour.jitter().mean_ms(),
-            behaviour.jitter().stddev_ms()));
-        LOG(INFO) << "New delay jitter: mean " << jitter_->mean()
-                  << "ms, stddev " << jitter_->stddev() << "ms.";
+    for (size_t i = 0; i < rates.rules.size(); ++i) {
+      if (u < (1 - weight) * rates.thresholds[i] +
+              weight * next_rates->thresholds[i]) {
+        Outcome outcome = rates.rules[i];
+        outcome.next_delay = next_rates->rules[i].delay;
+        outcome.weight = weight;
+        return outcome;
       }
-      sleep_time = std::floor((*jitter_)(urng_));
     }
-    result = grpc::Status(
-        static_cast<grpc::StatusCode>(behaviour.result()),
-        "an error occurred");
   }
+  return Outcome{OK, nullptr, nullptr, 0, 0};
+}
+
+bool ExpectedBehaviour::Matches(const Target& target, const CallInfo& call,
+                                std::string* peer) {
+  if (!target.peer.empty()) {
+    if (peer->empty()) {
+      *peer = call.context->peer();
+    }
+    if (peer->compare(0, target.peer.size(), target.peer) != 0) {
+      return false;
+    }
+  }
+  const auto& client_metadata = call.context->client_metadata();
+  for (const auto& entry : target.metadata) {
+    auto found = client_metadata.equal_range(entry.first);
+    if (!std::any_of(found.first, found.second,
+                     [&entry](const std::pair<grpc::string_ref,
+                                              grpc::string_ref>& value) {
+                       return value.second == entry.second;
+                     })) {
+      return false;
+    }
+  }
+  return true;
+}
+
+grpc::Status ExpectedBehaviour::BehaveUnary(grpc::ServerContext* context,
+                                            VirtualCall* clock,
+                                            const std::string& message,
+                                            const std::string& locale) {
+  // Holding the plan keeps its delay distributions alive while sampled.
+  std::shared_ptr<Plan> plan = PlanFor(*context);
+  const Outcome outcome =
+      Choose(plan.get(), &plan->unary, &plan->unary_targets, &Phase::unary,
+             CallInfo{kUnaryMethod, message, locale, context});
+  return Behave(context, clock, outcome);
+}
+
+grpc::Status ExpectedBehaviour::BehaveStream(grpc::ServerContext* context,
+                                             VirtualCall* clock,
+                                             const std::string& message,
+                                             const std::string& locale) {
+  std::shared_ptr<Plan> plan = PlanFor(*context);
+  const Outcome outcome =
+      Choose(plan.get(), &plan->stream, &plan->stream_targets, &Phase::stream,
+             CallInfo{kStreamMethod, message, locale, context});
+  return Behave(context, clock, outcome);
+}
+
+grpc::Status ExpectedBehaviour::Behave(grpc::ServerContext* context,
+                                       VirtualCall* clock,
+                                       const Outcome& outcome) {
+  // Sampling both delays at the same quantiles moves the whole
+  // distribution smoothly from one phase to the next.
+  const double u_component = Uniform();
+  const double u = Uniform();
+  double delay = 0;
+  if (outcome.delay) {
+    delay = outcome.delay->Sample(u_component, u);
+  }
+  if (outcome.weight > 0) {
+    double next_delay = 0;
+    if (outcome.next_delay) {
+      next_delay = outcome.next_delay->Sample(u_component, u);
+    }
+    delay += outcome.weight * (next_delay - delay);
+  }
+  const long long sleep_time =
+      std::llround(std::min(delay + outcome.fixed_ms, kMaxDelayMs));
+  grpc::Status result(static_cast<grpc::StatusCode>(outcome.result),
+                      "an error occurred");
   if (result.ok()) {
     LOG(INFO) << "Sleeping for " << sleep_time << "ms, then returning OK.";
   } else {
     LOG(INFO) << "Sleeping for " << sleep_time << "ms, then returning error ("
               << result.error_code() << ").";
   }
-  std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
+  grpc::Status slept = Sleep(context, clock, sleep_time);
+  if (!slept.ok()) {
+    LOG(INFO) << "Caller stopped waiting, abandoning the call with error ("
+              << slept.error_code() << ").";
+    return slept;
+  }
   return result;
 }
 
+grpc::Status ExpectedBehaviour::Sleep(grpc::ServerContext* context,
+                                      VirtualCall* clock,
+                                      long long sleep_ms) {
+  sleep_ms = std::max(0LL, std::min(sleep_ms,
+                                    static_cast<long long>(kMaxDelayMs)));
+  if (clock->enabled()) {
+    grpc::Status waiting = CheckCallerWaiting(context, stats_);
+    if (!waiting.ok()) {
+      return waiting;
+    }
+    if (!clock->Advance(sleep_ms)) {
+      stats_->Increment(ServerStats::kCallsPastDeadline);
+      return grpc::Status(grpc::DEADLINE_EXCEEDED,
+                          "Virtual deadline exceeded");
+    }
+    return grpc::Status::OK;
+  }
+
+  auto now = std::chrono::system_clock::now();
+  const auto wake = now + std::chrono::milliseconds(sleep_ms);
+  do {
+    grpc::Status waiting = CheckCallerWaiting(context, stats_);
+    if (!waiting.ok()) {
+      stats_->Increment(
+          ServerStats::kDelayMsSaved,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              wake - now).count());
+      return waiting;
+    }
+    std::this_thread::sleep_until(
+        std::min({wake, context->deadline(), now + kCancellationPoll}));
+    now = std::chrono::system_clock::now();
+  } while (now < wake);
+  return grpc::Status::OK;
+}
+
 }  // namespace srecon
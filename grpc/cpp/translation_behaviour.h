@@ -34,39 +34,282 @@
 #ifndef SRECON_TRANSLATION_BEHAVIOUR_H_
 #define SRECON_TRANSLATION_BEHAVIOUR_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <mutex>
-#include <random>
-#include <thread>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <grpc++/grpc++.h>
 
+#include "behaviour_session.h"
 #include "control.pb.h"
+#include "latency_distribution.h"
+#include "latency_trace.h"
+#include "translation_stats.h"
+#include "virtual_clock.h"
 
 namespace srecon {
 
+// How often a waiting call checks whether its caller has gone away. The
+// synchronous API offers no notification of cancellation.
+constexpr std::chrono::milliseconds kCancellationPoll(5);
+
+// Returns CANCELLED or DEADLINE_EXCEEDED if the caller no longer waits for a
+// reply, counting the abandoned call in stats; OK otherwise.
+grpc::Status CheckCallerWaiting(grpc::ServerContext* context,
+                                ServerStats* stats);
+
+// Returns the session named in the call's metadata, or "" if none is.
+std::string SessionOf(const grpc::ServerContext& context);
+
+// Seeds the random choices of behaviour, so that a run can be repeated: the
+// server's nth choice then depends only on seed and n, so calls arriving in
+// the same order get the same behaviour, whichever threads serve them. The
+// default, 0, seeds each thread from the system. Call before serving.
+void SeedBehaviour(uint32_t seed);
+
+// The behaviour the translator is asked to exhibit. Each test session has
+// its own, with its own script cursors and phase timing, so that sessions
+// can run concurrently against one server; calls outside any session, or
+// in one with no behaviour defined, use that of session "". A session
+// expires once it has gone session_ttl without a new definition, so that
+// ones their clients never removed do not pile up.
 class ExpectedBehaviour {
  public:
-  ExpectedBehaviour();
+  typedef std::shared_ptr<const LatencyDistribution> DelayPtr;
+
+  // Definitions may replay the traces in trace_dir, by paths relative to
+  // it; none if it is "".
+  ExpectedBehaviour(ServerStats* stats, const std::string& trace_dir,
+                    std::chrono::seconds session_ttl);
+  ~ExpectedBehaviour();
 
-  // Update the expected behaviour from a new requested definition.
-  void Update(const BehaviourDefinition& definition);
+  // Update the expected behaviour of the session from a new requested
+  // definition, now or at its activation time. An empty definition removes a
+  // session other than "". Returns
+  // INVALID_ARGUMENT, keeping the current behaviour, if the definition's
+  // rate rules are not a valid set of probabilities, or its phases are out
+  // of order or cannot be interpolated.
+  grpc::Status Update(const std::string& session,
+                      const BehaviourDefinition& definition);
 
-  // Return the desired return status. May sleep for a while.
-  grpc::Status BehaveUnary();
+  // Return the desired return status for a Translate call, or one row of
+  // an AllTranslations call, of the given message and locale. May sleep for
+  // a while, but gives up early if the call is cancelled or its deadline
+  // passes. In virtual time, the delay passes on clock instead.
+  grpc::Status BehaveUnary(grpc::ServerContext* context, VirtualCall* clock,
+                           const std::string& message,
+                           const std::string& locale);
 
-  grpc::Status BehaveStream();
+  grpc::Status BehaveStream(grpc::ServerContext* context, VirtualCall* clock,
+                            const std::string& message,
+                            const std::string& locale);
 
  private:
-  grpc::Status Behave(const Behaviour& behaviour);
-
-  Behaviour default_;
-  std::mutex mu_;
-  BehaviourDefinition definition_;
-  std::mt19937 urng_;
-  std::unique_ptr<std::normal_distribution<>> jitter_;
-  int next_unary_;
-  int next_stream_;
+  // What to do with one call: return result, after a delay if not nullptr.
+  struct Outcome {
+    ResultType result;
+    const LatencyDistribution* delay;
+    // Between phases, the delay blends into next_delay in proportion
+    // weight, at the same quantile.
+    const LatencyDistribution* next_delay;
+    double weight;
+    // A fixed delay, as recorded in a trace, on top of any other.
+    double fixed_ms;
+  };
+
+  // Rate rules: rule i applies if a uniform variate falls below
+  // thresholds[i] (and no earlier threshold).
+  struct Rates {
+    std::vector<double> thresholds;
+    std::vector<Outcome> rules;
+  };
+
+  // The compiled behaviour of one kind of call.
+  struct CallPlan {
+    // A scripted outcome, for length consecutive calls.
+    struct Run {
+      Outcome outcome;
+      uint32_t length;
+    };
+
+    // The scripted runs, and whether to start over after the last.
+    std::vector<Run> script;
+    bool loop;
+    // The position of the next call in the script: the index of its run in
+    // the upper 32 bits, and how many calls that run has had in the lower.
+    std::atomic<uint64_t> cursor;
+    // Then, a recorded trace, if any, while it lasts, and how to replay it;
+    // for ARRIVAL_ORDER, trace_cursor counts the calls which used it.
+    std::shared_ptr<const LatencyTrace> trace;
+    TraceReplay::Keying trace_keying;
+    bool trace_loop;
+    double trace_speed;
+    std::atomic<uint64_t> trace_cursor;
+    // Then, the rate rules, unless a phase has started.
+    Rates rates;
+  };
+
+  // The behaviour of the calls matching a Match. The method, message and
+  // locale are looked up by Dispatch; the rest of the Match is kept here.
+  struct Target {
+    std::string peer;
+    std::vector<std::pair<std::string, std::string>> metadata;
+    CallPlan calls;
+  };
+
+  // The targets of one kind of call, by the fields of their Match looked up
+  // through the hash table; see DispatchKey.
+  struct Dispatch {
+    // Within a bucket, targets with more of their Match left to check come
+    // first, as the more specific.
+    std::unordered_map<std::string, std::vector<std::unique_ptr<Target>>>
+        buckets;
+    // Bit i is set if any target's Match sets just the fields of pattern i,
+    // so calls look up only the keys that might be there.
+    unsigned patterns;
+  };
+
+  // What a call is, for matching targets.
+  struct CallInfo {
+    const char* method;
+    const std::string& message;
+    const std::string& locale;
+    grpc::ServerContext* context;
+  };
+
+  struct Phase {
+    std::chrono::milliseconds start_offset;
+    bool linear;
+    Rates unary;
+    Rates stream;
+  };
+
+  // A BehaviourDefinition compiled for use by concurrent calls. Replaced
+  // wholesale by Update, never modified once published except for the
+  // script cursors. Its size depends on the number of runs, not calls.
+  struct Plan {
+    // The untargeted behaviour, and the targets of each kind of call.
+    CallPlan unary;
+    CallPlan stream;
+    Dispatch unary_targets;
+    Dispatch stream_targets;
+    // When the plan takes effect, and its phases in order of start_offset.
+    std::chrono::system_clock::time_point activation;
+    std::chrono::steady_clock::time_point start;
+    std::vector<Phase> phases;
+    // Owns the delay distributions the outcomes point to, by serialized
+    // Jitter: identical definitions, as are typical of scripts, share one.
+    std::map<std::string, DelayPtr> delays;
+  };
+
+  // The plan of a session, and the one to replace it once activated.
+  struct Versions {
+    // Returns the plan in force at now: nullptr if the session's first plan
+    // is still pending.
+    std::shared_ptr<Plan> Current(
+        std::chrono::system_clock::time_point now) const;
+
+    std::shared_ptr<Plan> active;
+    std::shared_ptr<Plan> pending;
+    // When a session is dropped, unless defined again before; the TTL runs
+    // from the later of its last definition and that taking effect.
+    std::chrono::system_clock::time_point expiry;
+  };
+
+  typedef std::unordered_map<std::string, Versions> Sessions;
+
+  // Returns the plan for the call's session, or the global plan if it has
+  // none in force or it has expired.
+  std::shared_ptr<Plan> PlanFor(const grpc::ServerContext& context) const;
+
+  // Compiles the whole definition into plan.
+  grpc::Status CompilePlan(const BehaviourDefinition& definition,
+                           Plan* plan) const;
+
+  // Compiles one kind of call's scripted behaviours and rate rules, the
+  // untargeted ones into calls and the rest into targets.
+  static grpc::Status CompileTargets(
+      const google::protobuf::RepeatedPtrField<Behaviour>& behaviours,
+      const google::protobuf::RepeatedPtrField<RateRule>& rules, bool loop,
+      Plan* owner, CallPlan* calls, Dispatch* targets);
+
+  // Opens the trace to replay for calls, if any. Returns
+  // INVALID_ARGUMENT, with no detail of the filesystem, if it cannot.
+  grpc::Status CompileTrace(const TraceReplay& replay, CallPlan* calls) const;
+
+  static grpc::Status CompileCalls(
+      const std::vector<const Behaviour*>& behaviours,
+      const std::vector<const RateRule*>& rules, bool loop,
+      Plan* owner, CallPlan* calls);
+
+  static grpc::Status CompileRates(const std::vector<const RateRule*>& rules,
+                                   Plan* owner, Rates* rates);
+
+  // Returns the compiled distribution of jitter, owned by owner.
+  static const LatencyDistribution* CompileDelay(const Jitter& jitter,
+                                                 Plan* owner);
+
+  // Picks the outcome for call, made according to the plan, with calls and
+  // targets being those of its kind in the plan, and phase_rates the
+  // matching Rates of its phases.
+  static Outcome Choose(Plan* plan, CallPlan* calls, Dispatch* targets,
+                        Rates Phase::*phase_rates, const CallInfo& call);
+
+  // Returns the outcome for the next call in the script, if any is left.
+  static bool ChooseScripted(CallPlan* calls, Outcome* outcome);
+
+  // Returns the outcome recorded in the trace for the next call, if the
+  // trace has one.
+  static bool ChooseTraced(const Plan& plan, CallPlan* calls,
+                           Outcome* outcome);
+
+  // Picks a rate rule for u, with rates blending into next_rates, if not
+  // nullptr, in proportion weight.
+  static Outcome ChooseRate(const Rates& rates, const Rates* next_rates,
+                            double weight, double u);
+
+  // Whether call matches the target's peer and metadata. Fetches the
+  // caller's address into peer only if the target needs it and peer is
+  // still empty, as that allocates.
+  static bool Matches(const Target& target, const CallInfo& call,
+                      std::string* peer);
+
+  grpc::Status Behave(grpc::ServerContext* context, VirtualCall* clock,
+                      const Outcome& outcome);
+
+  // Sleeps for sleep_ms, unless the caller stops waiting first.
+  grpc::Status Sleep(grpc::ServerContext* context, VirtualCall* clock,
+                     long long sleep_ms);
+
+  // Registers a reader of global_ and sessions_, which must not wait on
+  // anything until it passes the epoch returned to EndRead.
+  unsigned BeginRead() const;
+  void EndRead(unsigned epoch) const;
+
+  // Starts a new epoch, and waits for the readers of the last one to leave,
+  // after which none can hold what Update has just replaced.
+  void WaitForReaders();
+
+  ServerStats* stats_;
+  const std::string trace_dir_;
+  const std::chrono::seconds session_ttl_;
+  // Serializes updates, which copy on write.
+  std::mutex update_mu_;
+  // Published by Update; calls read them under BeginRead, and copy out the
+  // plan they need, so they take no lock: std::atomic_load on a shared_ptr
+  // would, as libstdc++ guards those with a mutex.
+  std::atomic<const Versions*> global_;
+  std::atomic<const Sessions*> sessions_;
+  // The readers registered in even and odd epochs.
+  std::atomic<unsigned> epoch_;
+  mutable std::atomic<int> readers_[2];
 };
 
 }  // namespace srecon
@@ -0,0 +1,275 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include "translation_catalog.h"
+
+namespace srecon {
+
+const TranslationMap kTransDB =
+{
+  {"An error occurred",
+      {{"en_GB", "Pardon me all to hell"},
+       {"en_US", "Oops, my bad"},
+       {"de_DE", "Ein Fehler ist aufgetreten"}}},
+  {"Hello",
+      {{"en_GB", "How do you do"},
+       {"en_US", "Word up"},
+       {"de_DE", "Guten Tag"},
+       {"de_CH", "Grüezi"},
+       {"fr_CH", "Âllo"}}},
+  {"Goodbye",
+      {{"en_GB", "Toodle pip"},
+       {"en_US", "Smell you later"},
+       {"de_DE", "Tschüß"}}}
+};
+
+bool MatchesLocales(const AllTranslationsRequest& request,
+                    const std::string& locale) {
+  return request.locales_size() == 0 ||
+         std::any_of(request.locales().begin(), request.locales().end(),
+                     [&locale](const std::string& l) {
+                       return locale.find(l) != locale.npos;
+                     });
+}
+
+grpc::Status ReadCatalogFile(
+    const std::string& path,
+    const std::function<void(const AllTranslationsReply&)>& visit) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return grpc::Status(grpc::NOT_FOUND, "Cannot open " + path);
+  }
+  google::protobuf::io::IstreamInputStream input(&file);
+  AllTranslationsReply row;
+  for (int64_t rows = 0;; ++rows) {
+    // A stream per row, so that files may exceed its 2GB limit.
+    google::protobuf::io::CodedInputStream coded(&input);
+    uint32_t size;
+    if (!coded.ReadVarint32(&size)) {
+      break;
+    }
+    auto limit = coded.PushLimit(size);
+    if (!row.ParseFromCodedStream(&coded) || coded.BytesUntilLimit() > 0) {
+      return grpc::Status(grpc::INVALID_ARGUMENT,
+                          "Malformed row " + std::to_string(rows) + " of " +
+                              path);
+    }
+    coded.PopLimit(limit);
+    visit(row);
+  }
+  if (file.bad()) {
+    return grpc::Status(grpc::UNAVAILABLE, "Cannot read " + path);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status LoadCatalogFile(const std::string& path,
+                             TranslationMap* entries) {
+  TranslationMap::iterator message = entries->end();
+  return ReadCatalogFile(
+      path, [entries, &message](const AllTranslationsReply& row) {
+        // Rows usually come grouped by message, so look each up only once.
+        if (message == entries->end() || message->first != row.message()) {
+          message = entries->emplace(row.message(), TranslationsByLocale())
+                        .first;
+        }
+        message->second[row.locale()] = row.translation();
+      });
+}
+
+bool WriteCatalogRow(const AllTranslationsReply& row,
+                     google::protobuf::io::ZeroCopyOutputStream* out) {
+  google::protobuf::io::CodedOutputStream coded(out);
+  coded.WriteVarint32(static_cast<uint32_t>(row.ByteSizeLong()));
+  row.SerializeWithCachedSizes(&coded);
+  return !coded.HadError();
+}
+
+RowIterator::RowIterator(const TranslationMap& map)
+    : map_(&map), outer_(map.begin()) {
+  if (Valid()) {
+    inner_ = outer_->second.begin();
+  }
+  SkipEmpty();
+}
+
+void RowIterator::SeekMessage(const std::string& message) {
+  outer_ = map_->lower_bound(message);
+  if (Valid()) {
+    inner_ = outer_->second.begin();
+  }
+  SkipEmpty();
+}
+
+void RowIterator::SeekAfter(const std::string& message,
+                            const std::string& locale) {
+  outer_ = map_->lower_bound(message);
+  if (!Valid()) {
+    return;
+  }
+  if (outer_->first == message) {
+    inner_ = outer_->second.upper_bound(locale);
+  } else {
+    inner_ = outer_->second.begin();
+  }
+  SkipEmpty();
+}
+
+void RowIterator::Next() {
+  ++inner_;
+  SkipEmpty();
+}
+
+bool RowIterator::IsAfter(const std::string& message,
+                          const std::string& locale) const {
+  int order = this->message().compare(message);
+  return order > 0 || (order == 0 && this->locale() > locale);
+}
+
+void RowIterator::SkipEmpty() {
+  while (Valid() && inner_ == outer_->second.end()) {
+    ++outer_;
+    if (Valid()) {
+      inner_ = outer_->second.begin();
+    }
+  }
+}
+
+namespace {
+
+// FNV-1a, over each string and its terminating NUL (so that "ab","c" and
+// "a","bc" differ).
+uint64_t Fingerprint(uint64_t hash, const std::string& s) {
+  for (unsigned char c : s) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash * 1099511628211ULL;
+}
+
+}  // namespace
+
+TranslationCatalog::TranslationCatalog(TranslationMap entries)
+    : entries_(std::move(entries)), version_(14695981039346656037ULL),
+      size_(0) {
+  for (RowIterator it = Rows(); it.Valid(); it.Next()) {
+    version_ = Fingerprint(version_, it.message());
+    version_ = Fingerprint(version_, it.locale());
+    version_ = Fingerprint(version_, it.translation());
+    ++size_;
+  }
+  index_stride_ = std::max<size_t>(1, size_ / kIndexSize);
+  size_t row = 0;
+  for (RowIterator it = Rows(); it.Valid(); it.Next(), ++row) {
+    if (row % index_stride_ == 0) {
+      index_.push_back(it);
+    }
+  }
+}
+
+std::string TranslationCatalog::MakeToken(const std::string& message,
+                                          const std::string& locale) const {
+  AllTranslationsCursor cursor;
+  cursor.set_snapshot(version_);
+  cursor.set_message(message);
+  cursor.set_locale(locale);
+  return cursor.SerializeAsString();
+}
+
+grpc::Status TranslationCatalog::ParseToken(
+    const std::string& token, AllTranslationsCursor* cursor) const {
+  if (!cursor->ParseFromString(token)) {
+    return grpc::Status(grpc::INVALID_ARGUMENT, "Malformed page token");
+  }
+  if (cursor->snapshot() != version_) {
+    return grpc::Status(grpc::ABORTED,
+                        "Catalog changed since the page token was issued");
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status TranslationCatalog::Seek(const AllTranslationsRequest& request,
+                                      RowIterator* row) const {
+  *row = Rows();
+  if (request.page_token().empty()) {
+    if (!request.message().empty()) {
+      row->SeekMessage(request.message());
+    }
+    return grpc::Status::OK;
+  }
+  AllTranslationsCursor cursor;
+  grpc::Status status = ParseToken(request.page_token(), &cursor);
+  if (!status.ok()) {
+    return status;
+  }
+  row->SeekAfter(cursor.message(), cursor.locale());
+  // A token from before the message, e.g. a split point, skips ahead to it;
+  // one past the last row must not rewind.
+  if (!request.message().empty() && row->Valid() &&
+      row->message() < request.message()) {
+    row->SeekMessage(request.message());
+  }
+  return grpc::Status::OK;
+}
+
+std::vector<std::string> TranslationCatalog::SplitPoints(
+    int partitions) const {
+  std::vector<std::string> tokens;
+  // Any more partitions would only be skipped below, as too small.
+  const size_t ranges =
+      std::min<size_t>(std::max(partitions, 1), index_.size() + 1);
+  size_t last = 0;
+  for (size_t i = 1; i < ranges; ++i) {
+    // A range ends with the row just before the next range's first row.
+    size_t first_row = size_ * i / ranges;
+    size_t entry = first_row / index_stride_;
+    if (entry <= last) {
+      continue;  // Too few rows for this many ranges.
+    }
+    last = entry;
+    RowIterator end = index_[entry - 1];
+    for (size_t skip = 1; skip < index_stride_; ++skip) {
+      end.Next();
+    }
+    tokens.push_back(MakeToken(end.message(), end.locale()));
+  }
+  return tokens;
+}
+
+}  // namespace srecon
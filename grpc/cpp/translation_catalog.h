@@ -0,0 +1,163 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_TRANSLATION_CATALOG_H_
+#define SRECON_TRANSLATION_CATALOG_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <grpc++/grpc++.h>
+
+#include "translator.pb.h"
+
+namespace srecon {
+
+// Translations by message, then by locale. Both levels are ordered, so that
+// every row has a stable position from which a stream can be resumed.
+typedef std::map<std::string, std::string> TranslationsByLocale;
+typedef std::map<std::string, TranslationsByLocale> TranslationMap;
+
+// The built-in translations.
+extern const TranslationMap kTransDB;
+
+// Whether an AllTranslations request selects rows in the locale.
+bool MatchesLocales(const AllTranslationsRequest& request,
+                    const std::string& locale);
+
+// Catalog files hold AllTranslationsReply rows, without continuation tokens,
+// each preceded by its size as a varint.
+
+// Calls visit(row) with each row of the catalog file at path, in order.
+grpc::Status ReadCatalogFile(
+    const std::string& path,
+    const std::function<void(const AllTranslationsReply&)>& visit);
+
+// Adds the rows of the catalog file at path to entries, replacing any
+// translations already there.
+grpc::Status LoadCatalogFile(const std::string& path,
+                             TranslationMap* entries);
+
+// Appends a row to a catalog file. Returns false on a write error.
+bool WriteCatalogRow(const AllTranslationsReply& row,
+                     google::protobuf::io::ZeroCopyOutputStream* out);
+
+// Walks the rows of a TranslationMap in (message, locale) order.
+class RowIterator {
+ public:
+  explicit RowIterator(const TranslationMap& map);
+
+  // Positions the iterator at the first row of the given message, if any.
+  void SeekMessage(const std::string& message);
+
+  // Positions the iterator at the first row strictly after the given one.
+  void SeekAfter(const std::string& message, const std::string& locale);
+
+  bool Valid() const { return outer_ != map_->end(); }
+  void Next();
+
+  const std::string& message() const { return outer_->first; }
+  const std::string& locale() const { return inner_->first; }
+  const std::string& translation() const { return inner_->second; }
+
+  // Whether the current row sorts after the given one.
+  bool IsAfter(const std::string& message, const std::string& locale) const;
+
+ private:
+  // Moves past any messages with no translations.
+  void SkipEmpty();
+
+  const TranslationMap* map_;
+  TranslationMap::const_iterator outer_;
+  TranslationsByLocale::const_iterator inner_;
+};
+
+// An immutable snapshot of the translation database.
+class TranslationCatalog {
+ public:
+  explicit TranslationCatalog(TranslationMap entries);
+
+  // The index points into entries_, so would not survive a copy.
+  TranslationCatalog(const TranslationCatalog&) = delete;
+  TranslationCatalog& operator=(const TranslationCatalog&) = delete;
+
+  const TranslationMap& entries() const { return entries_; }
+
+  // Fingerprint of the contents; any change to the catalog changes it.
+  uint64_t version() const { return version_; }
+
+  // Number of (message, locale) rows.
+  size_t size() const { return size_; }
+
+  RowIterator Rows() const { return RowIterator(entries_); }
+
+  // Returns an opaque token for the position just after the given row.
+  std::string MakeToken(const std::string& message,
+                        const std::string& locale) const;
+
+  // Decodes a token produced by MakeToken(). Fails with INVALID_ARGUMENT if
+  // it is malformed, or ABORTED if it was issued for a different snapshot.
+  grpc::Status ParseToken(const std::string& token,
+                          AllTranslationsCursor* cursor) const;
+
+  // Positions row at the first row an AllTranslations request may send:
+  // just after its page token, if any, and no earlier than its message. Once
+  // a token has passed the last row, row stays exhausted. Fails as
+  // ParseToken does.
+  grpc::Status Seek(const AllTranslationsRequest& request,
+                    RowIterator* row) const;
+
+  // Returns up to (partitions - 1) ascending tokens which split the rows into
+  // ranges of roughly equal size, accurate to within 1/kIndexSize of all.
+  // Takes time in proportion to no more than kIndexSize partitions, however
+  // many are asked for, since that is all the index can tell apart.
+  std::vector<std::string> SplitPoints(int partitions) const;
+
+ private:
+  static const size_t kIndexSize = 4096;
+
+  const TranslationMap entries_;
+  uint64_t version_;
+  size_t size_;
+  // Every index_stride_-th row, so that split points need no full scan.
+  size_t index_stride_;
+  std::vector<RowIterator> index_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_TRANSLATION_CATALOG_H_
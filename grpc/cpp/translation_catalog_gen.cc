@@ -0,0 +1,127 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Writes a synthetic translation catalog, for translation_server --catalog,
+// of any size from a few rows to hundreds of millions, e.g.
+//
+//   build/translation_catalog_gen --messages=1000000 --locales=64
+//       --non_ascii=0.3 --output=logs/catalog.1M
+//
+// The catalog is generated deterministically from the flags, a row at a
+// time, so it is never all in memory.
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/text_format.h>
+
+#include "catalog_generator.h"
+#include "control.pb.h"
+#include "translation_catalog.h"
+#include "translator.pb.h"
+
+DEFINE_int64(messages, 1000, "Number of messages.");
+DEFINE_int32(locales, 8, "Number of locales, at most 5408.");
+DEFINE_double(coverage, 1,
+              "Probability that a message is translated to each locale.");
+DEFINE_string(message_length, "mean_ms: 20 stddev_ms: 8",
+              "Jitter giving the length of messages in characters, besides "
+              "their numbers, from its _ms fields.");
+DEFINE_string(translation_length,
+              "distribution: LOG_NORMAL mean_ms: 40 stddev_ms: 30",
+              "Jitter giving the length of translations in characters, from "
+              "its _ms fields.");
+DEFINE_double(non_ascii, 0.1, "Fraction of characters outside ASCII.");
+DEFINE_uint64(seed, 1, "Seed from which the catalog is generated.");
+DEFINE_string(output, "", "File to write the catalog to.");
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_locales < 0 || FLAGS_locales > srecon::kMaxSyntheticLocales) {
+    LOG(ERROR) << "--locales must be from 0 to "
+               << srecon::kMaxSyntheticLocales
+               << "; there are no more distinct locales.";
+    return 1;
+  }
+
+  srecon::CatalogOptions options;
+  options.messages = FLAGS_messages;
+  options.locales = FLAGS_locales;
+  options.coverage = FLAGS_coverage;
+  options.non_ascii = FLAGS_non_ascii;
+  options.seed = FLAGS_seed;
+  if (!google::protobuf::TextFormat::ParseFromString(
+          FLAGS_message_length, &options.message_length) ||
+      !google::protobuf::TextFormat::ParseFromString(
+          FLAGS_translation_length, &options.translation_length)) {
+    LOG(ERROR) << "Cannot parse --message_length or --translation_length "
+                  "as a Jitter.";
+    return 1;
+  }
+  if (FLAGS_output.empty()) {
+    LOG(ERROR) << "No --output given.";
+    return 1;
+  }
+  std::ofstream file(FLAGS_output, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    LOG(ERROR) << "Cannot open " << FLAGS_output;
+    return 1;
+  }
+
+  srecon::CatalogGenerator generator(options);
+  int64_t rows = 0;
+  bool ok = true;
+  {
+    google::protobuf::io::OstreamOutputStream out(&file);
+    generator.ForEachRow([&rows, &ok, &out](
+                             const srecon::AllTranslationsReply& row) {
+      ok = ok && srecon::WriteCatalogRow(row, &out);
+      ++rows;
+    });
+  }
+  file.close();
+  if (!ok || !file) {
+    LOG(ERROR) << "Cannot write " << FLAGS_output;
+    return 1;
+  }
+  std::cout << "Wrote " << rows << " translations of " << FLAGS_messages
+            << " messages to " << FLAGS_output << std::endl;
+  return 0;
+}
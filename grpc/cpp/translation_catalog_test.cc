@@ -0,0 +1,142 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Tests of TranslationCatalog's paging, which translation_dump relies on to
+// end. Run with `make test`; exits non-zero on the first failure.
+
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "translation_catalog.h"
+
+namespace srecon {
+
+namespace {
+
+// Pages through the rows of message page_size at a time, as translation_dump
+// does, and returns the locales sent. Gives up after max_pages, so that a
+// paging loop cannot hang the test.
+std::vector<std::string> PageMessage(const TranslationCatalog& catalog,
+                                     const std::string& message,
+                                     size_t page_size, size_t max_pages) {
+  std::vector<std::string> locales;
+  AllTranslationsRequest request;
+  request.set_message(message);
+  for (size_t page = 0; page < max_pages; ++page) {
+    RowIterator row = catalog.Rows();
+    CHECK(catalog.Seek(request, &row).ok());
+    size_t sent = 0;
+    for (; row.Valid() && row.message() == message && sent < page_size;
+         row.Next()) {
+      locales.push_back(row.locale());
+      request.set_page_token(catalog.MakeToken(row.message(), row.locale()));
+      ++sent;
+    }
+    if (sent < page_size) {
+      return locales;
+    }
+  }
+  LOG(FATAL) << "Paging " << message << " did not end after " << max_pages
+             << " pages";
+  return locales;
+}
+
+void TestPagesMessageAtEnd() {
+  TranslationCatalog catalog(kTransDB);
+  // The message whose rows end the catalog.
+  const std::string last = kTransDB.rbegin()->first;
+  const size_t rows = kTransDB.rbegin()->second.size();
+  // Each page size up to one more than the rows, so that the last page is
+  // sometimes full and sometimes short.
+  for (size_t page_size = 1; page_size <= rows + 1; ++page_size) {
+    const std::vector<std::string> locales =
+        PageMessage(catalog, last, page_size, rows + 2);
+    CHECK_EQ(locales.size(), rows) << "page size " << page_size;
+    size_t i = 0;
+    for (const auto& locale : kTransDB.rbegin()->second) {
+      CHECK_EQ(locales[i++], locale.first) << "page size " << page_size;
+    }
+  }
+}
+
+void TestTokenPastLastRowEnds() {
+  TranslationCatalog catalog(kTransDB);
+  const auto& last = *kTransDB.rbegin();
+  AllTranslationsRequest request;
+  request.set_message(last.first);
+  request.set_page_token(
+      catalog.MakeToken(last.first, last.second.rbegin()->first));
+  RowIterator row = catalog.Rows();
+  CHECK(catalog.Seek(request, &row).ok());
+  CHECK(!row.Valid());
+}
+
+void TestTokenBeforeMessageSkipsAhead() {
+  TranslationCatalog catalog(kTransDB);
+  const auto& first = *kTransDB.begin();
+  const auto& last = *kTransDB.rbegin();
+  AllTranslationsRequest request;
+  request.set_message(last.first);
+  request.set_page_token(
+      catalog.MakeToken(first.first, first.second.begin()->first));
+  RowIterator row = catalog.Rows();
+  CHECK(catalog.Seek(request, &row).ok());
+  CHECK(row.Valid());
+  CHECK_EQ(row.message(), last.first);
+  CHECK_EQ(row.locale(), last.second.begin()->first);
+}
+
+void TestMalformedToken() {
+  TranslationCatalog catalog(kTransDB);
+  AllTranslationsRequest request;
+  request.set_page_token("\xff not a cursor");
+  RowIterator row = catalog.Rows();
+  CHECK_EQ(catalog.Seek(request, &row).error_code(),
+           grpc::INVALID_ARGUMENT);
+}
+
+}  // namespace
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  srecon::TestPagesMessageAtEnd();
+  srecon::TestTokenPastLastRowEnds();
+  srecon::TestTokenBeforeMessageSkipsAhead();
+  srecon::TestMalformedToken();
+  LOG(INFO) << "PASS";
+  return 0;
+}
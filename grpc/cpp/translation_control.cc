@@ -33,6 +33,8 @@
 
 #include "translation_behaviour.h"
 #include "translation_control.h"
+#include "translation_stats.h"
+#include "translation_throttle.h"
 
 namespace srecon {
 
@@ -40,7 +42,24 @@ grpc::Status TranslatorControlImpl::SetBehaviour(
     grpc::ServerContext* context,
     const BehaviourDefinition* request,
     BehaviourReply* reply) {
-  behaviour_->Update(*request);
+  const std::string session = SessionOf(*context);
+  if (!session.empty() && request->has_throttle()) {
+    return grpc::Status(grpc::INVALID_ARGUMENT,
+                        "The throttle is server-wide, so cannot be set for a "
+                        "session.");
+  }
+  grpc::Status status = behaviour_->Update(session, *request);
+  if (status.ok() && session.empty()) {
+    throttle_->Configure(request->throttle(), request->activation_time_ms());
+  }
+  return status;
+}
+
+grpc::Status TranslatorControlImpl::GetStats(
+    grpc::ServerContext* context,
+    const StatsRequest* request,
+    StatsReply* reply) {
+  stats_->Export(reply);
   return grpc::Status::OK;
 }
 
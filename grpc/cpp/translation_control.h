@@ -41,19 +41,30 @@
 namespace srecon {
 
 class ExpectedBehaviour;
+class ServerStats;
+class ThroughputThrottle;
 
 class TranslatorControlImpl final : public TranslatorControl::Service {
   // rpc SetBehaviour (BehaviourDefinition) returns (BehaviourReply) {}
+  // rpc GetStats (StatsRequest) returns (StatsReply) {}
  public:
-  explicit TranslatorControlImpl(ExpectedBehaviour* behaviour)
-      : TranslatorControl::Service(), behaviour_(behaviour) {}
+  TranslatorControlImpl(ExpectedBehaviour* behaviour,
+                        ThroughputThrottle* throttle, ServerStats* stats)
+      : TranslatorControl::Service(), behaviour_(behaviour),
+        throttle_(throttle), stats_(stats) {}
 
   grpc::Status SetBehaviour(grpc::ServerContext* context,
                             const BehaviourDefinition* request,
                             BehaviourReply* reply) override;
 
+  grpc::Status GetStats(grpc::ServerContext* context,
+                        const StatsRequest* request,
+                        StatsReply* reply) override;
+
  private:
   ExpectedBehaviour* behaviour_;
+  ThroughputThrottle* throttle_;
+  ServerStats* stats_;
 };
 
 }  // namespace srecon
@@ -0,0 +1,210 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Dumps the translation catalog through the AllTranslations stream, resuming
+// after the last row received whenever the stream fails part-way. With
+// --partitions, the catalog is split into key ranges fetched concurrently.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpc++/grpc++.h>
+
+#include "translator.grpc.pb.h"
+
+DEFINE_string(translation_server, "localhost:50061",
+              "Server address of the translation server.");
+DEFINE_string(message, "", "If set, dump only translations of this message.");
+DEFINE_string(locales, "",
+              "Comma-separated locale substrings to dump; all if empty.");
+DEFINE_int32(page_size, 0,
+             "Rows to request per call; 0 streams everything in one call.");
+DEFINE_int32(deadline_ms, 20*1000, "Deadline per call in milliseconds.");
+DEFINE_int32(max_attempts, 5,
+             "Consecutive failed calls tolerated before giving up.");
+DEFINE_int32(partitions, 1,
+             "Number of key ranges to fetch over concurrent streams.");
+
+using grpc::ClientContext;
+using grpc::ClientReader;
+using grpc::Status;
+
+namespace srecon {
+
+class CatalogDumper {
+ public:
+  explicit CatalogDumper(std::shared_ptr<grpc::Channel> channel)
+      : stub_(Translator::NewStub(channel)) {}
+
+  // Writes every matching row to out, one per line. Returns the final status.
+  Status Dump(const AllTranslationsRequest& base, std::ostream* out) {
+    std::string token = base.page_token();
+    int failures = 0;
+    while (true) {
+      AllTranslationsRequest request(base);
+      request.set_page_token(token);
+
+      ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() +
+                           std::chrono::milliseconds(FLAGS_deadline_ms));
+      std::unique_ptr<ClientReader<AllTranslationsReply>> stream(
+          stub_->AllTranslations(&context, request));
+      int rows = 0;
+      AllTranslationsReply reply;
+      while (stream->Read(&reply)) {
+        *out << reply.message() << "\t" << reply.locale() << "\t"
+             << reply.translation() << "\n";
+        token = reply.continuation_token();
+        ++rows;
+      }
+      Status status = stream->Finish();
+
+      if (status.ok()) {
+        failures = 0;
+        if (request.page_size() <= 0 || rows < request.page_size()) {
+          return status;  // Reached the end.
+        }
+        continue;  // Fetch the next page.
+      }
+      // Any progress made resets the count of consecutive failures.
+      failures = rows > 0 ? 1 : failures + 1;
+      if (status.error_code() == grpc::ABORTED) {
+        // The catalog changed under us; the rows already printed cannot be
+        // combined with a new snapshot.
+        LOG(ERROR) << "Catalog snapshot changed, giving up: "
+                   << status.error_message();
+        return status;
+      }
+      if (status.error_code() == grpc::NOT_FOUND ||
+          status.error_code() == grpc::INVALID_ARGUMENT ||
+          failures >= FLAGS_max_attempts) {
+        return status;
+      }
+      LOG(WARNING) << "Stream failed after " << rows << " rows, error code "
+                   << status.error_code() << " (" << status.error_message()
+                   << "); resuming.";
+    }
+  }
+
+  // Fetches the key ranges suggested by the server concurrently, and writes
+  // them to out in order.
+  Status DumpPartitioned(const AllTranslationsRequest& base, int partitions,
+                         std::ostream* out) {
+    SplitPointsRequest request;
+    request.set_partitions(partitions);
+    SplitPointsReply splits;
+    ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() +
+                         std::chrono::milliseconds(FLAGS_deadline_ms));
+    Status status = stub_->SplitPoints(&context, request, &splits);
+    if (!status.ok()) {
+      return status;
+    }
+    LOG(INFO) << "Fetching " << splits.split_tokens_size() + 1
+              << " key ranges concurrently.";
+
+    const int ranges = splits.split_tokens_size() + 1;
+    std::vector<AllTranslationsRequest> requests(ranges, base);
+    std::vector<std::ostringstream> outputs(ranges);
+    std::vector<Status> results(ranges);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < ranges; ++i) {
+      if (i > 0) {
+        requests[i].set_page_token(splits.split_tokens(i - 1));
+      }
+      if (i < splits.split_tokens_size()) {
+        requests[i].set_end_token(splits.split_tokens(i));
+      }
+      workers.emplace_back([this, i, &requests, &outputs, &results]() {
+        results[i] = Dump(requests[i], &outputs[i]);
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+
+    // A range may legitimately hold nothing that matches the filters.
+    bool found = false;
+    for (int i = 0; i < ranges; ++i) {
+      if (results[i].ok()) {
+        found = true;
+      } else if (results[i].error_code() != grpc::NOT_FOUND) {
+        return results[i];
+      }
+      *out << outputs[i].str();
+    }
+    return found ? Status::OK
+                 : Status(grpc::NOT_FOUND, "Nothing matched the request");
+  }
+
+ private:
+  std::unique_ptr<Translator::Stub> stub_;
+};
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  srecon::AllTranslationsRequest request;
+  request.set_message(FLAGS_message);
+  request.set_page_size(FLAGS_page_size);
+  std::istringstream locales(FLAGS_locales);
+  std::string locale;
+  while (std::getline(locales, locale, ',')) {
+    if (!locale.empty()) {
+      request.add_locales(locale);
+    }
+  }
+
+  srecon::CatalogDumper dumper(grpc::CreateChannel(
+      FLAGS_translation_server, grpc::InsecureChannelCredentials()));
+  grpc::Status status =
+      FLAGS_partitions > 1
+          ? dumper.DumpPartitioned(request, FLAGS_partitions, &std::cout)
+          : dumper.Dump(request, &std::cout);
+  if (!status.ok()) {
+    LOG(ERROR) << "Dump failed, error code " << status.error_code() << ": "
+               << status.error_message();
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Broadcasts a BehaviourDefinition to a fleet of translation servers, so
+// that they all switch to it at the same moment. The definition is given an
+// activation time --activation_delay_ms from now, and sent to every replica
+// at once; each replica keeps its previous behaviour until that time by its
+// own clock, so the switch is as simultaneous as the replicas' clocks are
+// synchronised. Reports each replica's acknowledgement, and exits non-zero
+// if any replica rejected the definition, failed to answer, or answered too
+// late to switch with the rest.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/text_format.h>
+#include <grpc++/grpc++.h>
+
+#include "behaviour_session.h"
+#include "control.grpc.pb.h"
+
+DEFINE_string(replicas, "localhost:50061",
+              "Comma-separated addresses of the translation servers.");
+DEFINE_string(definition, "",
+              "File holding the BehaviourDefinition in text format.");
+DEFINE_int32(activation_delay_ms, 1000,
+             "How long after sending the definition it takes effect; 0 "
+             "switches each replica as soon as it is received.");
+DEFINE_int32(deadline_ms, 0,
+             "Deadline for each acknowledgement; defaults to the "
+             "activation delay.");
+DEFINE_string(session, "",
+              "If set, only calls of this behaviour session are affected.");
+
+namespace srecon {
+
+namespace {
+
+using Clock = std::chrono::system_clock;
+
+// A SetBehaviour call in flight to one replica.
+struct Broadcast {
+  std::string address;
+  std::unique_ptr<TranslatorControl::Stub> stub;
+  grpc::ClientContext context;
+  BehaviourReply reply;
+  grpc::Status status;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<BehaviourReply>> call;
+  Clock::time_point acked;
+};
+
+int64_t MillisSinceEpoch(Clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      time.time_since_epoch()).count();
+}
+
+}  // namespace
+
+// Sends definition to every replica at once, and waits for them all to
+// answer. Returns the number of replicas that will not switch on time.
+int BroadcastBehaviour(const std::vector<std::string>& replicas,
+                       BehaviourDefinition definition) {
+  const Clock::time_point sent = Clock::now();
+  const Clock::time_point activation =
+      sent + std::chrono::milliseconds(FLAGS_activation_delay_ms);
+  if (FLAGS_activation_delay_ms > 0) {
+    definition.set_activation_time_ms(MillisSinceEpoch(activation));
+  }
+  const int deadline_ms =
+      FLAGS_deadline_ms > 0 ? FLAGS_deadline_ms
+                            : std::max(FLAGS_activation_delay_ms, 1000);
+
+  grpc::CompletionQueue cq;
+  std::vector<std::unique_ptr<Broadcast>> calls;
+  for (const std::string& address : replicas) {
+    calls.emplace_back(new Broadcast);
+    Broadcast* b = calls.back().get();
+    b->address = address;
+    b->stub = TranslatorControl::NewStub(
+        grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    b->context.set_deadline(sent + std::chrono::milliseconds(deadline_ms));
+    if (!FLAGS_session.empty()) {
+      b->context.AddMetadata(kSessionMetadataKey, FLAGS_session);
+    }
+    b->call = b->stub->AsyncSetBehaviour(&b->context, definition, &cq);
+    b->call->Finish(&b->reply, &b->status, b);
+  }
+
+  for (size_t pending = calls.size(); pending > 0; --pending) {
+    void* tag;
+    bool ok;
+    CHECK(cq.Next(&tag, &ok));
+    static_cast<Broadcast*>(tag)->acked = Clock::now();
+  }
+
+  int failed = 0;
+  for (const std::unique_ptr<Broadcast>& b : calls) {
+    const int64_t ack_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            b->acked - sent).count();
+    std::cout << b->address << "\t" << ack_ms << "ms\t";
+    if (!b->status.ok()) {
+      std::cout << "error code " << b->status.error_code() << ": "
+                << b->status.error_message() << "\n";
+      ++failed;
+    } else if (FLAGS_activation_delay_ms > 0 && b->acked > activation) {
+      // The replica may have switched after the others, or not at all if
+      // its clock is behind.
+      std::cout << "acknowledged after the activation time\n";
+      ++failed;
+    } else {
+      std::cout << "OK\n";
+    }
+  }
+  return failed;
+}
+
+}  // namespace srecon
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  std::ifstream file(FLAGS_definition);
+  std::stringstream text;
+  text << file.rdbuf();
+  srecon::BehaviourDefinition definition;
+  if (!file ||
+      !google::protobuf::TextFormat::ParseFromString(text.str(),
+                                                     &definition)) {
+    LOG(ERROR) << "Cannot read a BehaviourDefinition from --definition="
+               << FLAGS_definition;
+    return 1;
+  }
+
+  std::vector<std::string> replicas;
+  std::istringstream addresses(FLAGS_replicas);
+  std::string address;
+  while (std::getline(addresses, address, ',')) {
+    if (!address.empty()) {
+      replicas.push_back(address);
+    }
+  }
+  if (replicas.empty()) {
+    LOG(ERROR) << "No --replicas given.";
+    return 1;
+  }
+
+  const int failed = srecon::BroadcastBehaviour(replicas, definition);
+  if (failed > 0) {
+    LOG(ERROR) << failed << " of " << replicas.size()
+               << " replicas will not switch on time.";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "translation_limiter.h"
+
+namespace srecon {
+
+namespace {
+
+// Weights of the newest sample in the short-term average, and in the
+// baseline. The baseline rises only slowly, so that sustained queueing is
+// not mistaken for the latency of an idle server.
+constexpr double kShortWeight = 0.1;
+constexpr double kBaselineWeightDown = 0.1;
+constexpr double kBaselineWeightUp = 0.001;
+// Recent latency may reach this multiple of the baseline before the limit
+// starts to shrink.
+constexpr double kTolerance = 1.5;
+// How far the limit moves towards each newly computed value.
+constexpr double kSmoothing = 0.2;
+
+double Average(double average, double sample, double weight) {
+  return average == 0 ? sample : average + weight * (sample - average);
+}
+
+}  // namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(int initial_limit, int min_limit,
+                                       int max_limit)
+    : min_limit_(std::max(1, min_limit)),
+      max_limit_(std::max(min_limit_, max_limit)),
+      limit_(std::min(std::max(initial_limit, min_limit_), max_limit_)),
+      in_flight_(0), short_latency_ms_(0), long_latency_ms_(0) {}
+
+bool ConcurrencyLimiter::TryAcquire(std::chrono::milliseconds* retry_after) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (in_flight_ < static_cast<int>(limit_)) {
+    ++in_flight_;
+    return true;
+  }
+  // On average, one place becomes free every (latency / limit).
+  *retry_after = std::chrono::milliseconds(static_cast<long long>(
+      std::ceil(std::max(1.0, short_latency_ms_ / limit_))));
+  return false;
+}
+
+void ConcurrencyLimiter::Release(std::chrono::steady_clock::duration latency,
+                                 bool sample) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const int in_flight = in_flight_--;
+  if (!sample) {
+    return;
+  }
+  const double latency_ms =
+      std::chrono::duration<double, std::milli>(latency).count();
+  short_latency_ms_ = Average(short_latency_ms_, latency_ms, kShortWeight);
+  long_latency_ms_ = Average(
+      long_latency_ms_, latency_ms,
+      latency_ms < long_latency_ms_ ? kBaselineWeightDown : kBaselineWeightUp);
+
+  double gradient = std::max(
+      0.5, std::min(1.0, kTolerance * long_latency_ms_ / short_latency_ms_));
+  if (gradient == 1.0 && in_flight < limit_ / 2) {
+    return;  // Not using the limit we have; no evidence that more would do.
+  }
+  // Shrink in proportion to the latency increase, but always allow for a
+  // small queue, so that the limit can probe upwards again.
+  double target = limit_ * gradient + std::sqrt(limit_);
+  double limit = (1 - kSmoothing) * limit_ + kSmoothing * target;
+  limit = std::min<double>(std::max<double>(limit, min_limit_), max_limit_);
+  if (static_cast<int>(limit) != static_cast<int>(limit_)) {
+    LOG_EVERY_N(INFO, 10) << "Concurrency limit now " << static_cast<int>(limit)
+                          << " (latency " << short_latency_ms_ << "ms, baseline "
+                          << long_latency_ms_ << "ms).";
+  }
+  limit_ = limit;
+}
+
+int ConcurrencyLimiter::limit() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return static_cast<int>(limit_);
+}
+
+Admission::Admission(ConcurrencyLimiter* limiter, bool sample)
+    : limiter_(limiter), sample_(sample),
+      start_(std::chrono::steady_clock::now()), admitted_(true),
+      retry_after_(0) {
+  if (limiter_) {
+    admitted_ = limiter_->TryAcquire(&retry_after_);
+  }
+}
+
+Admission::~Admission() {
+  if (limiter_ && admitted_) {
+    limiter_->Release(std::chrono::steady_clock::now() - start_, sample_);
+  }
+}
+
+}  // namespace srecon
@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_TRANSLATION_LIMITER_H_
+#define SRECON_TRANSLATION_LIMITER_H_
+
+#include <chrono>
+#include <mutex>
+
+namespace srecon {
+
+// An adaptive limit on the number of calls in progress, in the style of a
+// latency gradient: while recent latency stays close to the long-term
+// baseline, the limit grows; as queueing inflates latency, it shrinks in
+// proportion. Calls over the limit should be rejected at once, so that the
+// calls which are admitted still finish in good time.
+class ConcurrencyLimiter {
+ public:
+  ConcurrencyLimiter(int initial_limit, int min_limit, int max_limit);
+
+  // Admits a call, or returns false with a suggestion of when to retry.
+  bool TryAcquire(std::chrono::milliseconds* retry_after);
+
+  // Ends an admitted call. Only calls whose latency reflects the server's
+  // load (e.g. unary calls, not whole streams) should be sampled.
+  void Release(std::chrono::steady_clock::duration latency, bool sample);
+
+  int limit() const;
+
+ private:
+  const int min_limit_;
+  const int max_limit_;
+
+  mutable std::mutex mu_;
+  double limit_;
+  int in_flight_;
+  // Exponentially weighted moving averages of latency, in ms: one reacting
+  // within a few calls, and one forming the no-load baseline.
+  double short_latency_ms_;
+  double long_latency_ms_;
+};
+
+// Holds a place within a ConcurrencyLimiter for the duration of one call.
+// With no limiter, every call is admitted.
+class Admission {
+ public:
+  Admission(ConcurrencyLimiter* limiter, bool sample);
+  ~Admission();
+
+  bool admitted() const { return admitted_; }
+  std::chrono::milliseconds retry_after() const { return retry_after_; }
+
+  // Leaves the call out of the limiter's latency samples, as one refused
+  // without doing any work, whose speed says nothing of the load.
+  void DoNotSample() { sample_ = false; }
+
+ private:
+  ConcurrencyLimiter* limiter_;
+  bool sample_;
+  const std::chrono::steady_clock::time_point start_;
+  bool admitted_;
+  std::chrono::milliseconds retry_after_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_TRANSLATION_LIMITER_H_
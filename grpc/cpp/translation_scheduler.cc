@@ -0,0 +1,178 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <future>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "translation_scheduler.h"
+
+namespace srecon {
+
+namespace {
+
+// Weight of the newest sample in the service time estimate.
+constexpr double kServiceTimeWeight = 0.1;
+
+}  // namespace
+
+const char kPriorityMetadataKey[] = "request-priority";
+
+DeadlineScheduler::DeadlineScheduler(int workers)
+    : next_sequence_(0), service_time_us_(0), stopping_(false) {
+  for (int i = 0; i < workers; ++i) {
+    workers_.emplace_back(&DeadlineScheduler::Work, this);
+  }
+}
+
+DeadlineScheduler::~DeadlineScheduler() {
+  std::vector<Pending> dropped;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopping_ = true;
+    dropped.swap(queue_);
+  }
+  ready_.notify_all();
+  for (Pending& pending : dropped) {
+    pending.task.drop();
+  }
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void DeadlineScheduler::Submit(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!stopping_) {
+      queue_.push_back(Pending{std::move(task), next_sequence_++});
+      std::push_heap(queue_.begin(), queue_.end(), RunsLater);
+      ready_.notify_one();
+      return;
+    }
+  }
+  task.drop();
+}
+
+std::chrono::microseconds DeadlineScheduler::service_time() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return std::chrono::microseconds(static_cast<long long>(service_time_us_));
+}
+
+bool DeadlineScheduler::RunsLater(const Pending& a, const Pending& b) {
+  if (a.task.priority != b.task.priority) {
+    return a.task.priority < b.task.priority;
+  }
+  if (a.task.deadline != b.task.deadline) {
+    return a.task.deadline > b.task.deadline;
+  }
+  return a.sequence > b.sequence;
+}
+
+void DeadlineScheduler::Work() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    std::pop_heap(queue_.begin(), queue_.end(), RunsLater);
+    Task task = std::move(queue_.back().task);
+    queue_.pop_back();
+
+    auto now = std::chrono::system_clock::now();
+    auto expected = std::chrono::microseconds(
+        task.predictable ? static_cast<long long>(service_time_us_) : 0);
+    lock.unlock();
+    if ((task.deadline != std::chrono::system_clock::time_point::max() &&
+         now + expected > task.deadline) ||
+        (task.cancelled && task.cancelled())) {
+      task.drop();
+    } else {
+      task.run();
+      if (task.predictable) {
+        double elapsed_us = std::chrono::duration<double, std::micro>(
+            std::chrono::system_clock::now() - now).count();
+        lock.lock();
+        service_time_us_ = service_time_us_ == 0
+            ? elapsed_us
+            : service_time_us_ +
+                  kServiceTimeWeight * (elapsed_us - service_time_us_);
+        continue;
+      }
+    }
+    lock.lock();
+  }
+}
+
+grpc::Status RunScheduled(DeadlineScheduler* scheduler,
+                          grpc::ServerContext* context, bool predictable,
+                          ServerStats* stats,
+                          const std::function<grpc::Status()>& fn) {
+  std::promise<grpc::Status> done;
+  std::future<grpc::Status> result = done.get_future();
+  DeadlineScheduler::Task task;
+  task.priority = RequestedPriority(*context);
+  task.deadline = context->deadline();
+  task.predictable = predictable;
+  task.cancelled = [context]() { return context->IsCancelled(); };
+  task.run = [&done, &fn]() { done.set_value(fn()); };
+  task.drop = [&done, context, stats]() {
+    if (context->IsCancelled()) {
+      stats->Increment(ServerStats::kCallsCancelled);
+      done.set_value(grpc::Status::CANCELLED);
+      return;
+    }
+    stats->Increment(ServerStats::kCallsDroppedLate);
+    done.set_value(grpc::Status(grpc::DEADLINE_EXCEEDED,
+                                "Dropped, as it could not finish in time"));
+  };
+  scheduler->Submit(std::move(task));
+  return result.get();
+}
+
+int RequestedPriority(const grpc::ServerContext& context) {
+  const auto& metadata = context.client_metadata();
+  auto priority = metadata.find(kPriorityMetadataKey);
+  if (priority == metadata.end()) {
+    return 0;
+  }
+  return std::atoi(
+      std::string(priority->second.data(), priority->second.size()).c_str());
+}
+
+}  // namespace srecon
@@ -0,0 +1,121 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_TRANSLATION_SCHEDULER_H_
+#define SRECON_TRANSLATION_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <grpc++/grpc++.h>
+
+#include "translation_stats.h"
+
+namespace srecon {
+
+// Runs pending work on a fixed pool of workers: highest priority class first,
+// then earliest deadline first. Work which can no longer finish within its
+// deadline, given the recent service time, or whose caller has gone, is
+// dropped rather than run.
+//
+// Tasks are callbacks, so that a completion-queue driven server can hand
+// over calls directly; RunScheduled() adapts this for synchronous handlers.
+class DeadlineScheduler {
+ public:
+  struct Task {
+    // Higher classes are always served first.
+    int priority = 0;
+    // Absolute deadline; time_point::max() if none.
+    std::chrono::system_clock::time_point deadline =
+        std::chrono::system_clock::time_point::max();
+    // Whether the task takes about the usual service time (e.g. a unary
+    // call, not a stream), so that its completion time may be predicted,
+    // and its own service time feeds the estimate.
+    bool predictable = true;
+    // If set, whether the caller has gone, checked when the task is due.
+    std::function<bool()> cancelled;
+    // Exactly one of these is called, on a worker thread.
+    std::function<void()> run;
+    std::function<void()> drop;
+  };
+
+  explicit DeadlineScheduler(int workers);
+  // Drops all pending tasks, and waits for running ones to finish.
+  ~DeadlineScheduler();
+
+  void Submit(Task task);
+
+  // Smoothed service time of recent predictable tasks.
+  std::chrono::microseconds service_time() const;
+
+ private:
+  struct Pending {
+    Task task;
+    uint64_t sequence;  // Arrival order, to break ties.
+  };
+  // Heap order: the "largest" entry is the next to run.
+  static bool RunsLater(const Pending& a, const Pending& b);
+
+  void Work();
+
+  mutable std::mutex mu_;
+  std::condition_variable ready_;
+  std::vector<Pending> queue_;  // A heap, by RunsLater.
+  uint64_t next_sequence_;
+  double service_time_us_;
+  bool stopping_;
+  std::vector<std::thread> workers_;
+};
+
+// Runs fn through the scheduler on behalf of a synchronous handler, blocking
+// until it is done. Returns DEADLINE_EXCEEDED if the scheduler drops it as
+// late, or CANCELLED if the caller went away while it was queued.
+grpc::Status RunScheduled(DeadlineScheduler* scheduler,
+                          grpc::ServerContext* context, bool predictable,
+                          ServerStats* stats,
+                          const std::function<grpc::Status()>& fn);
+
+// The request metadata key carrying a call's priority class, an integer.
+extern const char kPriorityMetadataKey[];
+
+// Returns the priority class requested by a call, or 0.
+int RequestedPriority(const grpc::ServerContext& context);
+
+}  // namespace srecon
+
+#endif  // SRECON_TRANSLATION_SCHEDULER_H_
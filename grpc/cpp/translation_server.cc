@@ -31,23 +31,64 @@
  *
  */
 
+#include <chrono>
 #include <csignal>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/text_format.h>
 #include <grpc++/grpc++.h>
 
+#include "translation_catalog.h"
+#include "translation_limiter.h"
+#include "translation_scheduler.h"
 #include "translator.grpc.pb.h"
+#include "virtual_clock.h"
 
 // Error injection and control API:
 #include "translation_behaviour.h"
 #include "translation_control.h"
+#include "translation_stats.h"
+#include "translation_throttle.h"
 
 DEFINE_int32(port, 50061, "Port on which to listen.");
+DEFINE_bool(adaptive_concurrency, false,
+            "Whether to shed calls beyond an adaptive concurrency limit, "
+            "with RESOURCE_EXHAUSTED.");
+DEFINE_int32(initial_concurrency_limit, 20,
+             "Starting concurrency limit, with --adaptive_concurrency.");
+DEFINE_int32(min_concurrency_limit, 4,
+             "Lowest concurrency limit, with --adaptive_concurrency.");
+DEFINE_int32(max_concurrency_limit, 1000,
+             "Highest concurrency limit, with --adaptive_concurrency.");
+DEFINE_int32(scheduler_workers, 0,
+             "If > 0, serve unary calls on this many workers, by priority "
+             "class and then earliest deadline first. Streams are served "
+             "on arrival.");
+DEFINE_string(behaviour_file, "",
+              "If set, a BehaviourDefinition in text format to start with, "
+              "as if set by the control API; e.g. to replay a trace.");
+DEFINE_int32(behaviour_seed, 0,
+             "If set, seeds the random choices of injected behaviour, so "
+             "that benchmark runs can be repeated.");
+DEFINE_string(trace_dir, "",
+              "If set, the directory of the traces which behaviour "
+              "definitions may replay, by paths relative to it; otherwise "
+              "none may. The traces are mapped into memory, so must not be "
+              "truncated while in use.");
+DEFINE_int32(session_ttl_s, 3600,
+             "Seconds after which a test session's behaviour is dropped "
+             "unless it is defined again.");
+DEFINE_string(catalog, "",
+              "If set, a catalog file (e.g. from translation_catalog_gen) "
+              "whose translations to serve besides the built-in ones.");
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -61,111 +102,221 @@ using google::ERROR;
 
 namespace srecon {
 
-static std::map<std::string, std::map<std::string, std::string>> kTransDB =
-{
-  {"An error occurred",
-      {{"en_GB", "Pardon me all to hell"},
-       {"en_US", "Oops, my bad"},
-       {"de_DE", "Ein Fehler ist aufgetreten"}}},
-  {"Hello",
-      {{"en_GB", "How do you do"},
-       {"en_US", "Word up"},
-       {"de_DE", "Guten Tag"},
-       {"de_CH", "Grüezi"},
-       {"fr_CH", "Âllo"}}},
-  {"Goodbye",
-      {{"en_GB", "Toodle pip"},
-       {"en_US", "Smell you later"},
-       {"de_DE", "Tschüß"}}}
-};
-
 // Logic behind the server's behavior.
 class TranslationServiceImpl final : public Translator::Service {
  public:
-  explicit TranslationServiceImpl(ExpectedBehaviour* behaviour)
-      : Translator::Service(), behaviour_(behaviour) {}
+  // The limiter and scheduler are optional; without them, all calls are
+  // admitted, and served on arrival. The scheduler only orders unary calls.
+  TranslationServiceImpl(const TranslationCatalog* catalog,
+                         ExpectedBehaviour* behaviour,
+                         ThroughputThrottle* throttle, ServerStats* stats,
+                         ConcurrencyLimiter* limiter,
+                         DeadlineScheduler* scheduler)
+      : Translator::Service(), catalog_(catalog), behaviour_(behaviour),
+        throttle_(throttle), stats_(stats), limiter_(limiter),
+        scheduler_(scheduler) {}
 
  protected:
   Status Translate(ServerContext* context, const TranslationRequest* request,
                    TranslationReply* reply) override {
-    if (request->locale().empty()) {
+    stats_->Increment(ServerStats::kUnaryCalls);
+    Admission admission(limiter_, true);
+    if (!admission.admitted()) {
+      return Shed(context, admission);
+    }
+    if (!scheduler_) {
+      return DoTranslate(context, request, reply, &admission);
+    }
+    return RunScheduled(scheduler_, context, true, stats_,
+                        [this, context, request, reply, &admission]() {
+                          return DoTranslate(context, request, reply,
+                                             &admission);
+                        });
+  }
+
+  Status AllTranslations(ServerContext* context,
+                         const AllTranslationsRequest* request,
+                         ServerWriter<AllTranslationsReply>* writer) override {
+    stats_->Increment(ServerStats::kStreamCalls);
+    // A stream's duration depends on its length, not only on load.
+    Admission admission(limiter_, false);
+    if (!admission.admitted()) {
+      return Shed(context, admission);
+    }
+    // Served on arrival, not by the scheduler: a long stream would hold one
+    // of its workers throughout, and enough of them would starve unary calls.
+    return DoAllTranslations(context, request, writer);
+  }
+
+  Status SplitPoints(ServerContext* context, const SplitPointsRequest* request,
+                     SplitPointsReply* reply) override {
+    if (request->partitions() < 1) {
+      return Status(grpc::INVALID_ARGUMENT, "partitions must be positive.");
+    }
+    for (std::string& token : catalog_->SplitPoints(request->partitions())) {
+      reply->add_split_tokens()->swap(token);
+    }
+    LOG(INFO) << "Split catalog into " << reply->split_tokens_size() + 1
+              << " ranges, " << request->partitions() << " requested.";
+    return Status::OK;
+  }
+
+ private:
+  // Finds the requested translation, or returns why there is none.
+  Status Lookup(const TranslationRequest& request,
+                const std::string** translation) {
+    if (request.locale().empty()) {
       LOG(WARNING) << "Received request with no locale.";
       return Status(grpc::INVALID_ARGUMENT, "No locale set.");
     }
 
-    auto message = kTransDB.find(request->message());
-    if (message == kTransDB.end()) {
+    const TranslationMap& db = catalog_->entries();
+    auto message = db.find(request.message());
+    if (message == db.end()) {
       LOG_EVERY_N(INFO, 10) << "Received request for unknown message.";
       return Status(grpc::NOT_FOUND, "Message text unknown");
     }
 
     const auto& by_locale = message->second;
-    const auto translation = by_locale.find(request->locale());
-    if (translation == by_locale.end()) {
-      LOG(INFO) << "Cannot translate message \"" << request->message()
-                << "\" into locale \"" << request->locale() << "\"";
+    const auto found = by_locale.find(request.locale());
+    if (found == by_locale.end()) {
+      LOG(INFO) << "Cannot translate message \"" << request.message()
+                << "\" into locale \"" << request.locale() << "\"";
       return Status(grpc::NOT_FOUND,
-                    request->message() + " untranslatable to " +
-                    request->locale());
+                    request.message() + " untranslatable to " +
+                    request.locale());
+    }
+    *translation = &found->second;
+    return Status::OK;
+  }
+
+  Status DoTranslate(ServerContext* context, const TranslationRequest* request,
+                     TranslationReply* reply, Admission* admission) {
+    const std::string* translation;
+    Status found = Lookup(*request, &translation);
+    if (!found.ok()) {
+      // Rejected at once, so no measure of the load.
+      admission->DoNotSample();
+      return found;
     }
     auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
         context->deadline() - std::chrono::system_clock::now());
     LOG(INFO) << "Received translation request ["
               << request->ShortDebugString() << "], with deadline "
               << delta.count() << "ms from now.";
-    reply->set_translation(translation->second);
-    return behaviour_->BehaveUnary();  // May exceed deadline
+    reply->set_translation(*translation);
+    // Reports the virtual time taken, if the call is made in virtual time.
+    VirtualCall clock(context);
+    ThrottledCall throttled(throttle_, context);
+    if (!throttled.status().ok()) {
+      return throttled.status();
+    }
+    // Stops at the deadline
+    Status status = behaviour_->BehaveUnary(context, &clock, request->message(),
+                                            request->locale());
+    if (!status.ok()) {
+      return status;
+    }
+    return throttle_->Send(context, reply->ByteSizeLong());
   }
 
-  Status AllTranslations(ServerContext* context,
-                         const AllTranslationsRequest* request,
-                         ServerWriter<AllTranslationsReply>* writer) override {
+  Status DoAllTranslations(ServerContext* context,
+                           const AllTranslationsRequest* request,
+                           ServerWriter<AllTranslationsReply>* writer) {
+    VirtualCall clock(context);
     auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
         context->deadline() - std::chrono::system_clock::now());
     LOG(INFO) << "Received translation stream request ["
               << request->ShortDebugString() << "], with deadline "
               << delta.count() << "ms from now.";
+    ThrottledCall throttled(throttle_, context);
+    if (!throttled.status().ok()) {
+      return throttled.status();
+    }
+    RowIterator row = catalog_->Rows();
+    Status seek = catalog_->Seek(*request, &row);
+    if (!seek.ok()) {
+      LOG(INFO) << "Rejecting page token: " << seek.error_message();
+      return seek;
+    }
+    AllTranslationsCursor end;
+    if (!request->end_token().empty()) {
+      Status status = catalog_->ParseToken(request->end_token(), &end);
+      if (!status.ok()) {
+        LOG(INFO) << "Rejecting end token: " << status.error_message();
+        return status;
+      }
+    }
+
     bool found = false;
+    int sent = 0;
 
     Status result;
 
-    for (const auto& by_message : kTransDB) {
-      const std::string& message = by_message.first;
+    for (; row.Valid(); row.Next()) {
+      const std::string& message = row.message();
       if (!request->message().empty() && request->message() != message) {
-        continue;
+        break;  // Rows are ordered by message, so there are no more matches.
+      }
+      if (request->page_size() > 0 && sent >= request->page_size()) {
+        break;
+      }
+      if (!request->end_token().empty() &&
+          row.IsAfter(end.message(), end.locale())) {
+        break;
       }
 
-      for (const auto& by_locale : by_message.second) {
-        const std::string& locale = by_locale.first;
-        const std::string& translation = by_locale.second;
-        if (request->locales_size() == 0 ||
-            std::any_of(request->locales().begin(), request->locales().end(),
-                        [&locale](const std::string& l) {
-                          return locale.find(l) != locale.npos;
-                        })) {
-          found = true;
-          AllTranslationsReply reply;
-          reply.set_message(message);
-          reply.set_locale(locale);
-          reply.set_translation(translation);
-          result = behaviour_->BehaveStream();
-          if (!result.ok()) {
-            return result;
-          }
-          writer->Write(reply);
+      const std::string& locale = row.locale();
+      if (MatchesLocales(*request, locale)) {
+        found = true;
+        AllTranslationsReply reply;
+        reply.set_message(message);
+        reply.set_locale(locale);
+        reply.set_translation(row.translation());
+        reply.set_continuation_token(catalog_->MakeToken(message, locale));
+        // Also notices callers which have gone away, before any more work.
+        result = behaviour_->BehaveStream(context, &clock, message, locale);
+        if (result.ok()) {
+          result = throttle_->Send(context, reply.ByteSizeLong());
+        }
+        if (!result.ok()) {
+          return result;
+        }
+        if (!writer->Write(reply)) {
+          LOG(INFO) << "Stream broken after " << sent << " rows, abandoning.";
+          stats_->Increment(ServerStats::kCallsCancelled);
+          return Status::CANCELLED;
         }
+        stats_->Increment(ServerStats::kRowsSent);
+        ++sent;
       }
     }
 
-    if (!found) {
+    // Running out of rows while resuming is the normal end of a paged scan.
+    if (!found && request->page_token().empty()) {
       return Status(grpc::NOT_FOUND, "Nothing matched the request");
     }
 
     return Status::OK;
   }
 
- private:
+  // Rejects a call refused by the limiter, hinting when to retry.
+  Status Shed(ServerContext* context, const Admission& admission) {
+    stats_->Increment(ServerStats::kCallsShed);
+    LOG_EVERY_N(WARNING, 100) << "Overloaded, shedding calls above limit "
+                              << limiter_->limit() << ".";
+    context->AddTrailingMetadata(
+        "retry-after-ms", std::to_string(admission.retry_after().count()));
+    return Status(grpc::RESOURCE_EXHAUSTED,
+                  "Translator overloaded, retry later");
+  }
+
+  const TranslationCatalog* catalog_;
   ExpectedBehaviour* behaviour_;
+  ThroughputThrottle* throttle_;
+  ServerStats* stats_;
+  ConcurrencyLimiter* limiter_;
+  DeadlineScheduler* scheduler_;
 };
 
 }  // namespace srecon
@@ -182,9 +333,53 @@ void handle_sigterm(int) {
 }
 
 void RunServer(const std::string& server_address) {
-  srecon::ExpectedBehaviour injected;
-  srecon::TranslatorControlImpl behaviour_service(&injected);
-  srecon::TranslationServiceImpl service(&injected);
+  srecon::TranslationMap entries(srecon::kTransDB);
+  if (!FLAGS_catalog.empty()) {
+    grpc::Status status = srecon::LoadCatalogFile(FLAGS_catalog, &entries);
+    if (!status.ok()) {
+      LOG(FATAL) << "Cannot load --catalog: "  // Crash ok
+                 << status.error_message();
+    }
+  }
+  srecon::TranslationCatalog catalog(std::move(entries));
+  srecon::ServerStats stats;
+  srecon::SeedBehaviour(FLAGS_behaviour_seed);
+  srecon::ExpectedBehaviour injected(
+      &stats, FLAGS_trace_dir, std::chrono::seconds(FLAGS_session_ttl_s));
+  srecon::ThroughputThrottle throttle(&stats);
+  if (!FLAGS_behaviour_file.empty()) {
+    std::ifstream file(FLAGS_behaviour_file);
+    std::stringstream text;
+    text << file.rdbuf();
+    srecon::BehaviourDefinition definition;
+    if (!file || !google::protobuf::TextFormat::ParseFromString(text.str(),
+                                                               &definition)) {
+      LOG(FATAL) << "Cannot read a BehaviourDefinition from "  // Crash ok
+                 << FLAGS_behaviour_file;
+    }
+    grpc::Status status = injected.Update("", definition);
+    if (!status.ok()) {
+      LOG(FATAL) << "Invalid BehaviourDefinition in "  // Crash ok
+                 << FLAGS_behaviour_file << ": " << status.error_message();
+    }
+    throttle.Configure(definition.throttle(),
+                       definition.activation_time_ms());
+  }
+  srecon::TranslatorControlImpl behaviour_service(&injected, &throttle,
+                                                  &stats);
+  std::unique_ptr<srecon::ConcurrencyLimiter> limiter;
+  if (FLAGS_adaptive_concurrency) {
+    limiter.reset(new srecon::ConcurrencyLimiter(
+        FLAGS_initial_concurrency_limit, FLAGS_min_concurrency_limit,
+        FLAGS_max_concurrency_limit));
+  }
+  std::unique_ptr<srecon::DeadlineScheduler> scheduler;
+  if (FLAGS_scheduler_workers > 0) {
+    scheduler.reset(new srecon::DeadlineScheduler(FLAGS_scheduler_workers));
+  }
+  srecon::TranslationServiceImpl service(&catalog, &injected, &throttle,
+                                         &stats, limiter.get(),
+                                         scheduler.get());
 
   ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
@@ -197,11 +392,16 @@ void RunServer(const std::string& server_address) {
   translation_server = server.get();  // For the signal handler.
 
   LOG(INFO) << "Translation Service listening on " << server_address
-            << std::endl;
+            << ", serving " << catalog.size() << " translations (snapshot "
+            << std::hex << catalog.version() << std::dec << ")." << std::endl;
 
   // Wait for the server to shutdown. Note that some other thread must be
   // responsible for shutting down the server for this call to ever return.
   server->Wait();
+
+  srecon::StatsReply final_stats;
+  stats.Export(&final_stats);
+  LOG(INFO) << "Final stats: " << final_stats.ShortDebugString();
 }
 
 int main(int argc, char** argv) {
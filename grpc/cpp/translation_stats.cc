@@ -0,0 +1,67 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "translation_stats.h"
+
+namespace srecon {
+
+ServerStats::ServerStats() {
+  for (auto& counter : counters_) {
+    counter.store(0);
+  }
+}
+
+const char* ServerStats::Name(Counter counter) {
+  static const char* const kNames[kNumCounters] = {
+    "unary_calls",
+    "stream_calls",
+    "rows_sent",
+    "calls_cancelled",
+    "calls_past_deadline",
+    "delay_ms_saved",
+    "calls_shed",
+    "calls_dropped_late",
+    "throttled_ms",
+  };
+  return kNames[counter];
+}
+
+void ServerStats::Export(StatsReply* reply) const {
+  auto* counters = reply->mutable_counters();
+  for (int i = 0; i < kNumCounters; ++i) {
+    Counter counter = static_cast<Counter>(i);
+    (*counters)[Name(counter)] = Get(counter);
+  }
+}
+
+}  // namespace srecon
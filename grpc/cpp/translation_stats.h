@@ -0,0 +1,87 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_TRANSLATION_STATS_H_
+#define SRECON_TRANSLATION_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "control.pb.h"
+
+namespace srecon {
+
+// Counters of the work done, and avoided, by the translation server. Updates
+// are lock-free, so they may be made on every call.
+class ServerStats {
+ public:
+  enum Counter {
+    kUnaryCalls,
+    kStreamCalls,
+    kRowsSent,
+    // Calls given up because the caller cancelled, or its deadline passed.
+    kCallsCancelled,
+    kCallsPastDeadline,
+    // Injected delay which was not slept through, because of the above.
+    kDelayMsSaved,
+    // Calls rejected by admission control.
+    kCallsShed,
+    // Calls dropped by the scheduler, as they could not finish in time.
+    kCallsDroppedLate,
+    // Time calls spent waiting for throttled capacity.
+    kThrottledMs,
+    kNumCounters  // Must be last.
+  };
+
+  ServerStats();
+
+  void Increment(Counter counter, int64_t delta = 1) {
+    counters_[counter].fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  int64_t Get(Counter counter) const {
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  static const char* Name(Counter counter);
+
+  // Copies all counters into reply.
+  void Export(StatsReply* reply) const;
+
+ private:
+  std::atomic<int64_t> counters_[kNumCounters];
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_TRANSLATION_STATS_H_
@@ -0,0 +1,168 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <thread>
+
+#include <glog/logging.h>
+#include <google/protobuf/util/message_differencer.h>
+
+#include "translation_behaviour.h"
+#include "translation_throttle.h"
+
+namespace srecon {
+
+ThroughputThrottle::ThroughputThrottle(ServerStats* stats)
+    : stats_(stats), max_concurrency_(0), in_flight_(0),
+      messages_{0, 0, 0, Clock::now()}, bytes_{0, 0, 0, Clock::now()},
+      has_pending_(false) {}
+
+void ThroughputThrottle::Configure(const Throttle& config,
+                                   int64_t activation_time_ms) {
+  std::lock_guard<std::mutex> lock(mu_);
+  // Most definitions leave the throttle as it is, and should not refill its
+  // buckets; but they still replace any change pending.
+  if (google::protobuf::util::MessageDifferencer::Equals(config, active_)) {
+    has_pending_ = false;
+    return;
+  }
+  pending_ = config;
+  has_pending_ = true;
+  activation_ = std::chrono::system_clock::time_point(
+      std::chrono::milliseconds(activation_time_ms));
+  ActivateLocked(std::chrono::system_clock::now());
+}
+
+void ThroughputThrottle::ActivateLocked(
+    std::chrono::system_clock::time_point now) {
+  if (!has_pending_ || now < activation_) {
+    return;
+  }
+  has_pending_ = false;
+  active_ = pending_;
+  LOG(INFO) << "Throttling to " << pending_.ShortDebugString() << ".";
+  const Clock::time_point updated = Clock::now();
+  max_concurrency_ = std::max(0, pending_.max_concurrency());
+  // A bucket starts full, and always holds at least one message's worth.
+  messages_.rate = std::max(0.0, pending_.messages_per_second());
+  messages_.depth =
+      std::max(1.0, messages_.rate * std::max(0.0, pending_.burst_seconds()));
+  messages_.tokens = messages_.depth;
+  messages_.updated = updated;
+  bytes_.rate = std::max(0.0, pending_.bytes_per_second());
+  bytes_.depth = bytes_.rate * std::max(0.0, pending_.burst_seconds());
+  bytes_.tokens = bytes_.depth;
+  bytes_.updated = updated;
+  slot_freed_.notify_all();
+}
+
+grpc::Status ThroughputThrottle::Enter(grpc::ServerContext* context) {
+  std::unique_lock<std::mutex> lock(mu_);
+  ActivateLocked(std::chrono::system_clock::now());
+  if (max_concurrency_ == 0 || in_flight_ < max_concurrency_) {
+    ++in_flight_;
+    return grpc::Status::OK;
+  }
+  const Clock::time_point start = Clock::now();
+  grpc::Status waiting;
+  while (max_concurrency_ > 0 && in_flight_ >= max_concurrency_) {
+    waiting = CheckCallerWaiting(context, stats_);
+    if (!waiting.ok()) {
+      break;
+    }
+    slot_freed_.wait_for(lock, kCancellationPoll);
+    ActivateLocked(std::chrono::system_clock::now());
+  }
+  if (waiting.ok()) {
+    ++in_flight_;
+  }
+  stats_->Increment(ServerStats::kThrottledMs,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        Clock::now() - start).count());
+  return waiting;
+}
+
+void ThroughputThrottle::Exit() {
+  std::lock_guard<std::mutex> lock(mu_);
+  --in_flight_;
+  slot_freed_.notify_one();
+}
+
+grpc::Status ThroughputThrottle::Send(grpc::ServerContext* context,
+                                      size_t bytes) {
+  const Clock::time_point now = Clock::now();
+  Clock::duration wait;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    ActivateLocked(std::chrono::system_clock::now());
+    wait = std::max(messages_.Take(1, now), bytes_.Take(bytes, now));
+  }
+  if (wait <= Clock::duration::zero()) {
+    return grpc::Status::OK;
+  }
+  stats_->Increment(
+      ServerStats::kThrottledMs,
+      std::chrono::duration_cast<std::chrono::milliseconds>(wait).count());
+  return WaitUntil(context, now + wait);
+}
+
+ThroughputThrottle::Clock::duration ThroughputThrottle::Bucket::Take(
+    double cost, Clock::time_point now) {
+  if (rate <= 0) {
+    return Clock::duration::zero();
+  }
+  tokens = std::min(
+      depth,
+      tokens + rate * std::chrono::duration<double>(now - updated).count());
+  updated = now;
+  tokens -= cost;
+  if (tokens >= 0) {
+    return Clock::duration::zero();
+  }
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(-tokens / rate));
+}
+
+grpc::Status ThroughputThrottle::WaitUntil(grpc::ServerContext* context,
+                                           Clock::time_point wake) {
+  for (Clock::time_point now = Clock::now(); now < wake; now = Clock::now()) {
+    grpc::Status waiting = CheckCallerWaiting(context, stats_);
+    if (!waiting.ok()) {
+      return waiting;
+    }
+    std::this_thread::sleep_until(std::min(wake, now + kCancellationPoll));
+  }
+  return grpc::Status::OK;
+}
+
+}  // namespace srecon
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_TRANSLATION_THROTTLE_H_
+#define SRECON_TRANSLATION_THROTTLE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <grpc++/grpc++.h>
+
+#include "control.pb.h"
+#include "translation_stats.h"
+
+namespace srecon {
+
+// Throttles the translator's throughput as configured by a Throttle, to
+// emulate a backend short of CPU or bandwidth.
+//
+// The message and byte rates are token buckets which may go into debt: a
+// reply takes its tokens at once, and waits until the debt is repaid, so
+// replies leave in the order they asked, at the configured rate.
+class ThroughputThrottle {
+ public:
+  explicit ThroughputThrottle(ServerStats* stats);
+
+  // Replaces the limits, at activation_time_ms (since the Unix epoch) if
+  // that is later than now. Calls already waiting wait by the old rates. The
+  // same limits as now leave the buckets' state be.
+  void Configure(const Throttle& config, int64_t activation_time_ms);
+
+  // Waits for one of the concurrent call slots. Returns non-OK, without a
+  // slot, if the caller stops waiting first.
+  grpc::Status Enter(grpc::ServerContext* context);
+
+  // Frees a slot taken by Enter.
+  void Exit();
+
+  // Waits until a reply of the given size may be sent.
+  grpc::Status Send(grpc::ServerContext* context, size_t bytes);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Bucket {
+    // Refills the bucket up to now, then takes cost, returning how long it
+    // is until the bucket is out of debt.
+    Clock::duration Take(double cost, Clock::time_point now);
+
+    double rate;   // Tokens per second; unlimited if 0.
+    double depth;  // The most tokens the bucket holds.
+    double tokens;
+    Clock::time_point updated;
+  };
+
+  // Applies the pending configuration, if its time has come.
+  void ActivateLocked(std::chrono::system_clock::time_point now);
+
+  // Waits until wake, unless the caller stops waiting first.
+  grpc::Status WaitUntil(grpc::ServerContext* context, Clock::time_point wake);
+
+  ServerStats* stats_;
+  std::mutex mu_;
+  std::condition_variable slot_freed_;
+  int max_concurrency_;
+  int in_flight_;
+  Bucket messages_;
+  Bucket bytes_;
+  // The configuration in force.
+  Throttle active_;
+  // The configuration to apply at activation_, if has_pending_.
+  bool has_pending_;
+  Throttle pending_;
+  std::chrono::system_clock::time_point activation_;
+};
+
+// Holds a concurrent call slot of a throttle, if one could be had, for the
+// lifetime of the call.
+class ThrottledCall {
+ public:
+  ThrottledCall(ThroughputThrottle* throttle, grpc::ServerContext* context)
+      : throttle_(throttle), status_(throttle->Enter(context)) {}
+
+  ~ThrottledCall() {
+    if (status_.ok()) {
+      throttle_->Exit();
+    }
+  }
+
+  ThrottledCall(const ThrottledCall&) = delete;
+  ThrottledCall& operator=(const ThrottledCall&) = delete;
+
+  // OK if the call has a slot.
+  const grpc::Status& status() const { return status_; }
+
+ private:
+  ThroughputThrottle* throttle_;
+  grpc::Status status_;
+};
+
+}  // namespace srecon
+
+#endif  // SRECON_TRANSLATION_THROTTLE_H_
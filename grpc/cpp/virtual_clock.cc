@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "virtual_clock.h"
+
+namespace srecon {
+
+const char kVirtualBudgetMetadataKey[] = "virtual-budget-ms";
+const char kVirtualElapsedMetadataKey[] = "virtual-elapsed-ms";
+
+namespace {
+
+// The budget of a call in virtual time with no deadline.
+const char kNoDeadline[] = "none";
+
+// Finds key in metadata, returning whether it is there, and its value.
+bool FindMetadata(
+    const std::multimap<grpc::string_ref, grpc::string_ref>& metadata,
+    const char* key, std::string* value) {
+  auto found = metadata.find(key);
+  if (found == metadata.end()) {
+    return false;
+  }
+  value->assign(found->second.data(), found->second.size());
+  return true;
+}
+
+}  // namespace
+
+VirtualCall::VirtualCall(grpc::ServerContext* context)
+    : context_(context), enabled_(false), budget_ms_(-1), elapsed_ms_(0) {
+  std::string budget;
+  if (FindMetadata(context->client_metadata(), kVirtualBudgetMetadataKey,
+                   &budget)) {
+    enabled_ = true;
+    if (budget != kNoDeadline) {
+      budget_ms_ = std::max(0LL, std::atoll(budget.c_str()));
+    }
+  }
+}
+
+VirtualCall::~VirtualCall() {
+  if (enabled_) {
+    context_->AddTrailingMetadata(kVirtualElapsedMetadataKey,
+                                  std::to_string(elapsed_ms_));
+  }
+}
+
+bool VirtualCall::Advance(long long ms) {
+  elapsed_ms_ += std::max(0LL, ms);
+  if (has_deadline() && elapsed_ms_ >= budget_ms_) {
+    elapsed_ms_ = budget_ms_;
+    return false;
+  }
+  return true;
+}
+
+void VirtualCall::Propagate(grpc::ClientContext* outgoing,
+                            long long limit_ms) const {
+  long long budget_ms = -1;
+  if (has_deadline()) {
+    budget_ms = budget_ms_ - elapsed_ms_;
+  }
+  if (limit_ms > 0 && (budget_ms < 0 || limit_ms < budget_ms)) {
+    budget_ms = limit_ms;
+  }
+  outgoing->AddMetadata(
+      kVirtualBudgetMetadataKey,
+      budget_ms < 0 ? kNoDeadline : std::to_string(budget_ms));
+}
+
+bool VirtualCall::AdvanceBy(const grpc::ClientContext& outgoing) {
+  return Advance(VirtualElapsedMs(outgoing));
+}
+
+void StartVirtualCall(grpc::ClientContext* context, long long deadline_ms) {
+  context->AddMetadata(
+      kVirtualBudgetMetadataKey,
+      deadline_ms > 0 ? std::to_string(deadline_ms) : kNoDeadline);
+}
+
+long long VirtualElapsedMs(const grpc::ClientContext& context) {
+  std::string elapsed;
+  if (!FindMetadata(context.GetServerTrailingMetadata(),
+                    kVirtualElapsedMetadataKey, &elapsed)) {
+    return 0;
+  }
+  return std::atoll(elapsed.c_str());
+}
+
+}  // namespace srecon
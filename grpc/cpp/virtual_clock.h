@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2017, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * Neither the name of Google Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SRECON_VIRTUAL_CLOCK_H_
+#define SRECON_VIRTUAL_CLOCK_H_
+
+#include <grpc++/grpc++.h>
+
+namespace srecon {
+
+// Simulated time for tests. A call made in virtual time carries its budget
+// (the time left until its deadline) in request metadata, instead of a real
+// deadline; servers let injected delays pass instantly, counting them
+// against the budget, and report the virtual time the call took in trailing
+// metadata. Deadlines then expire at the same points as in real time, but
+// the scenarios run in milliseconds.
+extern const char kVirtualBudgetMetadataKey[];
+extern const char kVirtualElapsedMetadataKey[];
+
+// The virtual time of a call being served. Calls not made in virtual time
+// are unaffected.
+class VirtualCall {
+ public:
+  // Reads the call's virtual budget, if it has one.
+  explicit VirtualCall(grpc::ServerContext* context);
+
+  // Reports the virtual time the call took to its caller, so the server
+  // must destroy this before the call completes.
+  ~VirtualCall();
+
+  VirtualCall(const VirtualCall&) = delete;
+  VirtualCall& operator=(const VirtualCall&) = delete;
+
+  bool enabled() const { return enabled_; }
+  bool has_deadline() const { return budget_ms_ >= 0; }
+  long long elapsed_ms() const { return elapsed_ms_; }
+
+  // Lets ms of virtual time pass, or only until the deadline, returning
+  // false, if that comes first.
+  bool Advance(long long ms);
+
+  // Makes an outgoing call in this call's virtual time, with what is left of
+  // its budget, or at most limit_ms if that is positive.
+  void Propagate(grpc::ClientContext* outgoing, long long limit_ms) const;
+
+  // Counts the virtual time taken by a finished outgoing call. Returns false
+  // if the deadline has passed.
+  bool AdvanceBy(const grpc::ClientContext& outgoing);
+
+ private:
+  grpc::ServerContext* context_;
+  bool enabled_;
+  long long budget_ms_;  // Negative if there is no deadline.
+  long long elapsed_ms_;
+};
+
+// Makes a call in virtual time, with a deadline of deadline_ms, or none if
+// not positive.
+void StartVirtualCall(grpc::ClientContext* context, long long deadline_ms);
+
+// Returns the virtual time a finished call took, or 0 if it did not report
+// any.
+long long VirtualElapsedMs(const grpc::ClientContext& context);
+
+}  // namespace srecon
+
+#endif  // SRECON_VIRTUAL_CLOCK_H_
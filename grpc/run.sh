@@ -10,6 +10,10 @@ To run tests against the example server instead of your own, set the environment
 variable USE_DEMO to a non-empty value, e.g.:
     USE_DEMO=1 ./run.sh
 
+To have the translation server also serve a large synthetic catalog, made with
+build/translation_catalog_gen, set CATALOG to its file, e.g.:
+    CATALOG=logs/catalog.1M ./run.sh
+
 EOF
 }
 
@@ -91,7 +95,7 @@ _build() {
   mkdir -p "$BUILDDIR"
   mkdir -p "$LOGDIR"
   {
-    make -C cpp translation_server exerciser
+    make -C cpp translation_server exerciser translation_catalog_gen
     make "$language"
   } || {
     red "Build failed."
@@ -105,6 +109,7 @@ _launch() {
   if [[ $1 != greeter_only ]] ; then
     build/translation_server \
       --port=${TRANSLATION_SERVER_PORT} \
+      ${CATALOG:+--catalog="$CATALOG"} \
       --log_dir="$LOGDIR" --logbufsecs=1 --logbuflevel=-1 \
       > "$LOGDIR/translation_server.STDOUT" \
       2> "$LOGDIR/translation_server.STDERR" & _pid_translator=$!